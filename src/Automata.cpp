@@ -1,4 +1,10 @@
 #include "Automata.h"
+#include <sys/time.h>
+#include <mbedtls/base64.h>
+#include <lwip/sockets.h>
+#include <sys/select.h>
+#include <unistd.h>
+#include <esp_vfs_eventfd.h>
 
 Automata *Automata::instance = nullptr;
 
@@ -21,6 +27,7 @@ Automata::Automata(String deviceName, String category,
       mqttClient(espClient)
 {
     instance = this;
+    offlineQueue.configure(OFFLINE_QUEUE_BYTES, OFFLINE_QUEUE_MESSAGES, DROP_OLDEST);
 }
 
 Automata::Automata(String deviceName, String category,
@@ -37,6 +44,7 @@ Automata::Automata(String deviceName, String category,
       mqttClient(espClient)
 {
     instance = this;
+    offlineQueue.configure(OFFLINE_QUEUE_BYTES, OFFLINE_QUEUE_MESSAGES, DROP_OLDEST);
 }
 
 AsyncWebServer &Automata::getWebserver()
@@ -50,19 +58,299 @@ void Automata::useCreds() { USE_SERVER_CREDS = true; }
 void Automata::useMQTT() { transport = TRANSPORT_MQTT; }
 void Automata::useWSS() { transport = TRANSPORT_WSS; }
 
+// MQTT 5 is only implemented by MQTTWebSocket; PubSubClient stays on 3.1.1.
+// device_id travels as a user property instead of a JSON field.
+void Automata::useMQTT5(uint32_t messageExpirySec)
+{
+    USE_MQTT5 = true;
+    messageExpiry = messageExpirySec;
+}
+
+// Keep the broker session (subscriptions + queued QoS 1 actions) across
+// reconnects. Relies on mqttClientId() being the same on every boot.
+void Automata::usePersistentSession(uint32_t sessionExpirySec)
+{
+    USE_PERSISTENT_SESSION = true;
+    sessionExpiry = sessionExpirySec;
+}
+
+String Automata::mqttClientId()
+{
+    return "automata-" + convertToLowerAndUnderscore(deviceName) + "-" + macAddr;
+}
+
 // ─── Publish (unified) ───────────────────────────────────────
-void Automata::publish(const String &topic, const String &payload, bool retained)
+//  qos=1 is honoured on the MQTT-WS transport (PUBACK tracked in
+//  MQTTWebSocket's in-flight window). PubSubClient can only publish
+//  QoS 0, so the TCP path ignores it.
+//
+//  While the broker is unreachable (or earlier messages are still
+//  waiting) publishes go to the offline queue and are drained from
+//  loop() after reconnect, in order.
+//
+//  MQTT_PUB_WOULD_BLOCK is handed back to the caller instead: the
+//  socket is connected but backed up, so queueing more would only
+//  hide the problem. Wait for onWritable() and try again.
+// ─────────────────────────────────────────────────────────────
+MQTTPublishStatus Automata::publish(const String &topic, const String &payload, bool retained, uint8_t qos)
+{
+    return publish(topic, (const uint8_t *)payload.c_str(), payload.length(), retained, qos);
+}
+
+MQTTPublishStatus Automata::publish(const String &topic, const uint8_t *data, size_t length,
+                                    bool retained, uint8_t qos)
+{
+    if (offlineQueue.empty() && isConnected())
+    {
+        MQTTPublishStatus st = transportPublish(topic.c_str(), data, length, retained, qos);
+        if (st == MQTT_PUB_OK || st == MQTT_PUB_QUEUED ||
+            st == MQTT_PUB_WOULD_BLOCK || st == MQTT_PUB_TOO_LARGE)
+            return st;
+    }
+
+    return queueOffline(topic, data, length, retained, qos);
+}
+
+MQTTPublishStatus Automata::queueOffline(const String &topic, const uint8_t *data, size_t length,
+                                         bool retained, uint8_t qos)
+{
+    if (!offlineQueue.push(topic.c_str(), data, length, retained, qos))
+    {
+        Serial.println("[Automata] Offline queue full, dropped publish to " + topic);
+        return MQTT_PUB_FAILED;
+    }
+    return MQTT_PUB_QUEUED;
+}
+
+// Same as publish(), for a document. Its size is taken up front with
+// measureJson()/measureMsgPack() and it is serialized straight into the
+// transport: into the MQTT-WS frame buffer, or through PubSubClient's
+// beginPublish() stream. Only a message that has to wait in the offline
+// queue is rendered into payloadBuf.
+MQTTPublishStatus Automata::publishDoc(const String &topic, JsonDocument &doc,
+                                       bool retained, uint8_t qos)
+{
+    bool addId = !(USE_MQTT5 && transport == TRANSPORT_WSS) && doc["device_id"].isNull();
+    if (addId)
+        doc["device_id"] = deviceId;
+
+    MQTTPublishStatus st = MQTT_PUB_NOT_CONNECTED;
+    if (offlineQueue.empty() && isConnected())
+        st = streamPublish(topic.c_str(), doc, retained, qos);
+    if (st != MQTT_PUB_OK && st != MQTT_PUB_QUEUED &&
+        st != MQTT_PUB_WOULD_BLOCK && st != MQTT_PUB_TOO_LARGE)
+    {
+        size_t len = serializeToBuffer(doc, payloadFormat);
+        st = queueOffline(topic, (const uint8_t *)payloadBuf.data(), len, retained, qos);
+    }
+
+    if (addId)
+        doc.remove("device_id");
+    if (st == MQTT_PUB_QUEUED)
+        wake(); // sent from loop()
+    return st;
+}
+
+namespace
 {
+    // Collects small writes from the serializer into socket-sized chunks
+    class ChunkedPrint : public Print
+    {
+    public:
+        explicit ChunkedPrint(Print &out) : out(out) {}
+
+        size_t write(uint8_t c) override
+        {
+            if (used == sizeof(buf))
+                finish();
+            buf[used++] = c;
+            return 1;
+        }
+
+        size_t write(const uint8_t *data, size_t size) override
+        {
+            for (size_t i = 0; i < size; i++)
+                write(data[i]);
+            return size;
+        }
+
+        void finish()
+        {
+            if (used && out.write(buf, used) != used)
+                shortWrite = true;
+            used = 0;
+        }
+
+        // Every chunk reached the underlying Print
+        bool ok() const { return !shortWrite; }
+
+    private:
+        Print &out;
+        uint8_t buf[128];
+        size_t used = 0;
+        bool shortWrite = false;
+    };
+
+    // Holds a recursive mutex for the enclosing scope
+    class LockGuard
+    {
+    public:
+        explicit LockGuard(SemaphoreHandle_t m) : m(m) { xSemaphoreTakeRecursive(m, portMAX_DELAY); }
+        ~LockGuard() { xSemaphoreGiveRecursive(m); }
+
+    private:
+        SemaphoreHandle_t m;
+    };
+}
+
+MQTTPublishStatus Automata::streamPublish(const char *topic, JsonDocument &doc,
+                                          bool retained, uint8_t qos)
+{
+    bool pack = payloadFormat == FORMAT_MSGPACK;
+    size_t len = pack ? measureMsgPack(doc) : measureJson(doc);
+
     if (transport == TRANSPORT_MQTT)
     {
-        mqttClient.publish(topic.c_str(), payload.c_str(), retained);
+        if (!mqttClient.beginPublish(topic, len, retained))
+            return MQTT_PUB_FAILED;
+        ChunkedPrint out(mqttClient);
+        size_t n = pack ? serializeMsgPack(doc, out) : serializeJson(doc, out);
+        out.finish();
+        return (mqttClient.endPublish() && n == len) ? MQTT_PUB_OK : MQTT_PUB_FAILED;
     }
-    else
+
+    if (!mqttWS)
+        return MQTT_PUB_NOT_CONNECTED;
+    return mqttWS->tryPublishWith(topic, len, [&](uint8_t *dst)
+                                  { return pack ? serializeMsgPack(doc, dst, len)
+                                                : serializeJson(doc, dst, len); },
+                                  retained, qos);
+}
+
+MQTTPublishStatus Automata::transportPublish(const char *topic, const uint8_t *payload, size_t length,
+                                             bool retained, uint8_t qos)
+{
+    if (transport == TRANSPORT_MQTT)
+        return mqttClient.publish(topic, payload, length, retained) ? MQTT_PUB_OK : MQTT_PUB_FAILED;
+
+    // MQTT-WS: topic is already a flat MQTT topic (e.g. "topic/sendData")
+    if (!mqttWS)
+        return MQTT_PUB_NOT_CONNECTED;
+    return mqttWS->tryPublish(topic, payload, length, retained, qos);
+}
+
+void Automata::onWritable(MQTTWritableCallback cb)
+{
+    _handleWritable = cb;
+    if (mqttWS)
+        mqttWS->onWritable(cb);
+}
+
+bool Automata::isWritable()
+{
+    if (transport == TRANSPORT_MQTT)
+        return mqttClient.connected();
+    return mqttWS && mqttWS->writable();
+}
+
+// ─── Offline queue drain ─────────────────────────────────────
+//  Starts after a random holdoff (so a fleet recovering from the same
+//  outage does not hit the broker at once), then sends at most
+//  drainRate messages per second.
+// ─────────────────────────────────────────────────────────────
+void Automata::drainOfflineQueue()
+{
+    unsigned long now = millis();
+
+    if (!isConnected())
+    {
+        wasConnected = false;
+        return;
+    }
+    if (!wasConnected)
+    {
+        wasConnected = true;
+        drainNextAt = now + (drainJitterMs ? random(drainJitterMs) : 0);
+    }
+    if (offlineQueue.empty() || (long)(now - drainNextAt) < 0)
+        return;
+
+    if (!draining)
     {
-        // MQTT-WS: topic is already a flat MQTT topic (e.g. "topic/sendData")
-        if (mqttWS)
-            mqttWS->publish(topic, payload, retained);
+        draining = true;
+        drainStartedAt = now;
+        Serial.printf("[Automata] Draining %u queued publishes\n",
+                      offlineQueue.stats().depth);
     }
+
+    unsigned long interval = drainRate ? 1000UL / drainRate : 0;
+    PendingPublish msg;
+    while ((long)(now - drainNextAt) >= 0 && offlineQueue.peek(msg))
+    {
+        MQTTPublishStatus st = transportPublish(msg.topic, msg.payload, msg.length, msg.retained, msg.qos);
+        if (st == MQTT_PUB_WOULD_BLOCK)
+            break; // socket backed up — not the message's fault, just wait
+        if (st != MQTT_PUB_OK && st != MQTT_PUB_QUEUED)
+        {
+            // Still connected but refused (too large, window full...):
+            // retry a few times, then drop it so it can't block the queue.
+            if (++drainFailures >= 3)
+            {
+                Serial.printf("[Automata] Dropping queued publish to %s\n", msg.topic);
+                offlineQueue.drop();
+                drainFailures = 0;
+            }
+            break;
+        }
+        drainFailures = 0;
+        offlineQueue.pop();
+        drainNextAt += interval;
+    }
+
+    // Don't let a stall turn into a burst later
+    if ((long)(now - drainNextAt) > (long)interval)
+        drainNextAt = now + interval;
+
+    if (offlineQueue.empty())
+    {
+        draining = false;
+        OfflineQueueStats &st = offlineQueue.stats();
+        st.lastDrainMs = now - drainStartedAt;
+        Serial.printf("[Automata] Offline queue drained in %u ms\n", st.lastDrainMs);
+    }
+}
+
+void Automata::setOfflineQueue(size_t maxBytes, uint16_t maxMessages, PublishDropPolicy policy)
+{
+    offlineQueue.configure(maxBytes, maxMessages, policy);
+}
+
+void Automata::setDrainRate(uint16_t messagesPerSecond, uint16_t jitterMs)
+{
+    drainRate = messagesPerSecond;
+    drainJitterMs = jitterMs;
+}
+
+OfflineQueueStats Automata::getOfflineQueueStats()
+{
+    return offlineQueue.stats();
+}
+
+void Automata::onPublishComplete(MQTTPublishCallback cb)
+{
+    _handlePublishComplete = cb;
+    if (mqttWS)
+        mqttWS->onPublishComplete(cb);
+}
+
+MQTTPublishStats Automata::getPublishStats()
+{
+    return mqttWS ? mqttWS->stats() : MQTTPublishStats();
+}
+
+MQTTConnectionStats Automata::getConnectionStats()
+{
+    return mqttWS ? mqttWS->connectionStats() : MQTTConnectionStats();
 }
 
 // ─── Error handler ───────────────────────────────────────────
@@ -83,14 +371,27 @@ void Automata::wsConnect()
         mqttWS = new MQTTWebSocket();
 
     // Build a unique clientId
-    String clientId = "automata-" + convertToLowerAndUnderscore(deviceName) + "-" + macAddr;
+    String clientId = mqttClientId();
     mqttWS->setCredentials(clientId.c_str(), mqttUser, mqttPassword);
+    mqttWS->setPersistentSession(USE_PERSISTENT_SESSION, sessionExpiry);
+    mqttWS->setMaxInflight(maxInflight);
+    if (USE_MQTT5)
+    {
+        mqttWS->setProtocolVersion(5);
+        mqttWS->setMessageExpiry(messageExpiry);
+        mqttWS->setUserProperty("device_id", deviceId);
+    }
+    if (_handlePublishComplete)
+        mqttWS->onPublishComplete(_handlePublishComplete);
+    if (_handleWritable)
+        mqttWS->onWritable(_handleWritable);
 
     // ── Callbacks ────────────────────────────
     mqttWS->onConnect([this]()
                       {
                           Serial.println("[Automata] MQTT-WS connected");
                           wsSubscribed = false; // force re-subscribe
+                          resetDeltaState();
                       });
 
     mqttWS->onDisconnect([this]()
@@ -98,16 +399,17 @@ void Automata::wsConnect()
         Serial.println("[Automata] MQTT-WS disconnected");
         wsSubscribed = false; });
 
-    mqttWS->onMessage([this](const String &topic, const String &payload)
-                      {
-        Serial.println("[Automata] MQTT-WS ← [" + topic + "] " + payload);
+    mqttWS->onMessageRaw([this](const char *topic, size_t topicLen, const uint8_t *payload, size_t length)
+                         {
+        Serial.printf("[Automata] MQTT-WS ← [%.*s] %u bytes\n", (int)topicLen, topic, (unsigned)length);
+        dispatchMessage(topic, topicLen, payload, length); });
 
-        // Mirror the same routing logic that used to live in handleWSSMessage()
-        // but now driven by topic string, not STOMP destination path.
-        if (topic.indexOf("update") != -1)
-            handleUpdate(payload);
-        else if (topic.indexOf("action") != -1)
-            handleAction(payload); });
+    // Stored before begin() so device and user topics all go out in the
+    // single SUBSCRIBE sent after CONNACK; later subscribe() calls for
+    // the same filters are de-duplicated by MQTTWebSocket.
+    for (auto &f : userFilters)
+        mqttWS->subscribe(f.first, f.second);
+    wsSubscribeTopics();
 
     // ssl=true for wss:// through Cloudflare tunnel (port 443)
     // ssl=false for plain ws:// on a local network (port 9001)
@@ -125,6 +427,9 @@ void Automata::wsSubscribeTopics()
     if (!mqttWS)
         return;
 
+    routeDeviceTopics();
+    if (USE_MQTT5)
+        mqttWS->setUserProperty("device_id", deviceId);
     String updateTopic = makeTopic("update/" + deviceId);
     String actionTopic = makeTopic("action/" + deviceId);
 
@@ -157,14 +462,152 @@ void Automata::handleUpdate(const String &msg)
 
 void Automata::handleAction(const String &msg)
 {
-    String res = msg;
-    String topic = makeTopic("action/" + deviceId);
+    handleAction((const uint8_t *)msg.c_str(), msg.length());
+}
+
+// Parses straight from the receive buffer: no String copies between the
+// transport and the user's onActionReceived handler. The buffer is shared
+// with every other route for the topic, so it is only read; ArduinoJson
+// copies the strings into action.data, and a payload with backslashes to
+// strip is copied into actionBuf first.
+void Automata::handleAction(const uint8_t *payload, size_t length)
+{
+    Serial.println("[Automata] Action received");
+    Action action;
+    DeserializationError err;
+    if (isMsgPack(payload, length))
+    {
+        err = deserializeMsgPack(action.data, (const char *)payload, length);
+    }
+    else
+    {
+        const char *json = (const char *)payload;
+        if (memchr(json, '\\', length))
+        {
+            actionBuf.assign(json, json + length);
+            length = sanitizeJson(actionBuf.data(), length);
+            json = actionBuf.data();
+        }
+        err = deserializeJson(action.data, json, length);
+    }
+    if (err)
+        Serial.printf("[Automata] Action parse error: %s\n", err.c_str());
+    if (_handleAction)
+        _handleAction(action);
+
+    bool rebootFlag = action.data["reboot"] | false;
+
+    // Echo back the same data for reference
+    JsonDocument &ack = action.data;
+    ack["_cid"] = ack["_cid"] | "";
+    ack["key"] = "actionAck";
+    ack["actionAck"] = "Success";
+    ack["status"] = "ok";
+    ack["device_id"] = deviceId;
+
+    // ACK back via whichever transport is active. publishDoc() already
+    // queues it while disconnected; a backed-up socket must not lose it
+    // either, so park it in the offline queue too.
+    String ackTopic = makeTopic("ackAction");
+    MQTTPublishStatus st = publishDoc(ackTopic, ack, false, 1);
+    if (st == MQTT_PUB_WOULD_BLOCK)
+    {
+        size_t len = serializeToBuffer(ack, payloadFormat);
+        st = queueOffline(ackTopic, (const uint8_t *)payloadBuf.data(), len, false, 1);
+    }
+    if (st == MQTT_PUB_OK || st == MQTT_PUB_QUEUED)
+        Serial.println(st == MQTT_PUB_OK ? "[Automata] Action ACK sent"
+                                         : "[Automata] Action ACK queued");
+    else
+        Serial.printf("[Automata] Action ACK not sent (status %d)\n", (int)st);
 
-    // Reuse the same mqttCallback path so action handling is unified
-    mqttCallback(
-        (char *)topic.c_str(),
-        (byte *)res.c_str(),
-        res.length());
+    if (rebootFlag)
+    {
+        Serial.println("[Automata] Reboot flag — restarting");
+        if (transport == TRANSPORT_MQTT)
+            mqttClient.disconnect();
+        else if (mqttWS)
+            mqttWS->disconnect();
+        delay(200);
+        ESP.restart();
+    }
+}
+
+// ─── Topic subscriptions / dispatch ──────────────────────────
+//  Every inbound message, on either transport, is routed through
+//  one TopicTrie: the device's own update/action topics plus any
+//  filters registered with subscribe().
+// ─────────────────────────────────────────────────────────────
+bool Automata::subscribe(const String &filter, HandleMessage handler, uint8_t qos)
+{
+    return addSubscription(filter, {handler, nullptr}, qos);
+}
+
+bool Automata::subscribe(const String &filter, HandleMessageBytes handler, uint8_t qos)
+{
+    return addSubscription(filter, {nullptr, handler}, qos);
+}
+
+bool Automata::addSubscription(const String &filter, const MessageRoute &route, uint8_t qos)
+{
+    if (!subscriptions.insert(filter, route))
+    {
+        handleError("Invalid topic filter: " + filter);
+        return false;
+    }
+
+    bool known = false;
+    for (auto &f : userFilters)
+        known |= (f.first == filter);
+    if (!known)
+        userFilters.push_back({filter, qos});
+
+    if (transport == TRANSPORT_MQTT && mqttClient.connected())
+        mqttClient.subscribe(filter.c_str(), qos);
+    else if (transport == TRANSPORT_WSS && mqttWS)
+        mqttWS->subscribe(filter, qos);
+    return true;
+}
+
+void Automata::routeDeviceTopics()
+{
+    if (routedDeviceId == deviceId)
+        return;
+    if (routedDeviceId.length())
+    {
+        subscriptions.remove(makeTopic("update/" + routedDeviceId));
+        subscriptions.remove(makeTopic("action/" + routedDeviceId));
+    }
+    routedDeviceId = deviceId;
+    MessageRoute update, action;
+    update.text = [this](const String &, const String &payload)
+    { handleUpdate(payload); };
+    action.bytes = [this](const char *, size_t, const uint8_t *payload, size_t length)
+    { handleAction(payload, length); };
+    subscriptions.insert(makeTopic("update/" + deviceId), update);
+    subscriptions.insert(makeTopic("action/" + deviceId), action);
+}
+
+// Byte-span handlers get a read-only view of the buffer, so every route
+// sees the payload as it arrived; String handlers share one copy of
+// topic/payload built only if such a handler matches.
+void Automata::dispatchMessage(const char *topic, size_t topicLen, const uint8_t *payload, size_t length)
+{
+    String topicStr, payloadStr;
+    bool haveStrings = false;
+    size_t hits = subscriptions.match(topic, topicLen, [&](const MessageRoute &route)
+                                      {
+        if (route.bytes)
+            return route.bytes(topic, topicLen, payload, length);
+        if (!haveStrings)
+        {
+            topicStr = String(topic, topicLen);
+            payloadStr = String((const char *)payload, length);
+            haveStrings = true;
+        }
+        route.text(topicStr, payloadStr); });
+    if (!hits)
+        Serial.printf("[Automata] No handler for topic %.*s\n", (int)topicLen, topic);
 }
 
 // ─── begin() ─────────────────────────────────────────────────
@@ -197,16 +640,47 @@ void Automata::getConfig()
 {
     String sv = preferences.getString("config", "");
     deviceSecret = preferences.getString("deviceSecret", "");
+    JsonDocument resp;
     if (sv != "")
     {
         Serial.println("[Automata] Config found in preferences: " + sv);
-        JsonDocument resp;
         deserializeJson(resp, sv);
     }
     else
     {
         Serial.println("[Automata] No config in preferences");
     }
+
+    if (FAST_BOOT)
+    {
+        deviceId = preferences.getString("deviceId", resp["id"] | "");
+        applyRegFlags(preferences.getUInt("regFlags", 0));
+        if (deviceId != "")
+            Serial.println("[Automata] Fast boot with cached id=" + deviceId);
+    }
+}
+
+// ─── Fast boot ───────────────────────────────────────────────
+//  With a deviceId cached from an earlier registration, connect to the
+//  broker as soon as WiFi is up and revalidate the registration from
+//  loop() once connected. Call before begin().
+// ─────────────────────────────────────────────────────────────
+void Automata::useFastBoot() { FAST_BOOT = true; }
+
+void Automata::applyRegFlags(uint32_t flags)
+{
+    payloadFormat = (USE_MSGPACK && (flags & 0x01)) ? FORMAT_MSGPACK : FORMAT_JSON;
+    keyIdsConfirmed = USE_KEY_IDS && (flags & 0x02);
+}
+
+void Automata::connectTransport()
+{
+    if (isConnected())
+        return;
+    if (transport == TRANSPORT_WSS)
+        wsConnect();
+    else
+        mqttConnect();
 }
 
 // ─── loop() ──────────────────────────────────────────────────
@@ -215,6 +689,8 @@ void Automata::loop()
     esp_task_wdt_reset();
     unsigned long currentMillis = millis();
     lastLoopTick = millis();
+    pollHttp();
+
     // ── TCP MQTT path ─────────────────────────
     if (transport == TRANSPORT_MQTT)
     {
@@ -240,6 +716,9 @@ void Automata::loop()
             wsSubscribed = false;
     }
 
+    flushLiveBatch();
+    drainOfflineQueue();
+
     ArduinoOTA.handle();
 
     if (currentMillis - previousMillis >= (unsigned long)getDelay())
@@ -259,6 +738,15 @@ void Automata::loop()
         regTime = currentMillis;
     }
 
+    // Fast boot: confirm the cached registration once the broker is up
+    static unsigned long revalidateAt = 0;
+    if (registrationStale && isConnected() &&
+        (long)(currentMillis - revalidateAt) >= 0)
+    {
+        registerDevice(); // clears registrationStale when it succeeds
+        revalidateAt = currentMillis + regWait;
+    }
+
     // if (ESP.getFreeHeap() < 12000)
     // {
     //     Serial.printf(
@@ -273,11 +761,20 @@ void Automata::loop()
 void Automata::keepWiFiAlive()
 {
     esp_task_wdt_add(NULL);
+    esp_vfs_eventfd_config_t eventfdConfig = ESP_VFS_EVENTD_CONFIG_DEFAULT();
+    esp_err_t err = esp_vfs_eventfd_register(&eventfdConfig);
+    if (err == ESP_OK || err == ESP_ERR_INVALID_STATE) // already registered by the sketch
+        wakeFd = eventfd(0, 0);
+    if (wakeFd < 0)
+        Serial.println("[Automata] No eventfd, loop falls back to polling");
+    loopTask = xTaskGetCurrentTaskHandle();
     const TickType_t delayConnected = pdMS_TO_TICKS(30000);
     const TickType_t delayDisconnected = pdMS_TO_TICKS(5000);
     unsigned long wifiLostSince = 0;
     for (;;)
     {
+        uint32_t sleepMs = LOOP_POLL_MS;
+        int brokerFd = -1;
         if ((millis() - lastLoopTick) > 30000)
         {
             Serial.println(
@@ -299,7 +796,17 @@ void Automata::keepWiFiAlive()
                 if (USE_REGISTER_DEVICE)
                 {
                     configTime((int)(5.5 * 3600), 0, ntpServer);
-                    registerDevice();
+                    if (FAST_BOOT && deviceId != "")
+                    {
+                        // Trust the cached id for now; loop() revalidates
+                        isDeviceRegistered = true;
+                        registrationStale = true;
+                        connectTransport();
+                    }
+                    else
+                    {
+                        registerDevice();
+                    }
                 }
 
                 if (!MDNS.begin(convertToLowerAndUnderscore(deviceName).c_str()))
@@ -327,36 +834,152 @@ void Automata::keepWiFiAlive()
         {
             wifiLostSince = 0;
             loop();
+            sleepMs = nextWakeIn(brokerFd);
         }
-        vTaskDelay(pdMS_TO_TICKS(10));
+        waitForWork(sleepMs, brokerFd);
     }
 }
 
-// ─── registerDevice ──────────────────────────────────────────
-void Automata::registerDevice()
+// ─── Event-driven loop ───────────────────────────────────────
+//  Between passes the loop task blocks in select() on the broker socket
+//  (plain TCP or TLS) and on wakeFd, an eventfd that async HTTP
+//  completions, publishes that left work for loop() and wake() write
+//  to. Otherwise it sleeps until the next deadline loop() keeps
+//  (telemetry delay, coalescing window, queue drain), at most
+//  LOOP_MAX_SLEEP_MS. The socket is only ever selected on by the task
+//  that also reads and closes it, so a reconnect can't leave a stale fd
+//  behind. With no socket yet, or no eventfd, it polls every
+//  LOOP_POLL_MS.
+// ─────────────────────────────────────────────────────────────
+void Automata::wake()
 {
-    static uint8_t retryCount = 0;
-    static unsigned long lastAttempt = 0;
+    if (!loopTask || xTaskGetCurrentTaskHandle() == loopTask)
+        return;
+    if (wakeFd >= 0)
+    {
+        uint64_t one = 1;
+        write(wakeFd, &one, sizeof(one));
+    }
+    else
+        xTaskNotifyGive(loopTask);
+}
 
-    Serial.printf("[Automata] Registering device (attempt %d)...\n", retryCount + 1);
+// With work already waiting (ms 0) the next pass runs right away; a
+// pending wake-up is still consumed.
+void Automata::waitForWork(uint32_t ms, int fd)
+{
+    if (wakeFd < 0)
+    {
+        TickType_t ticks = pdMS_TO_TICKS(ms);
+        if (ms && !ticks)
+            ticks = 1; // sub-tick deadlines round up
+        ulTaskNotifyTake(pdTRUE, ticks);
+        return;
+    }
 
-    JsonDocument doc;
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(wakeFd, &readable);
+    int maxFd = wakeFd;
+    if (fd >= 0)
+    {
+        FD_SET(fd, &readable);
+        if (fd > maxFd)
+            maxFd = fd;
+    }
+    timeval tv = {(time_t)(ms / 1000), (suseconds_t)((ms % 1000) * 1000)};
+    int ready = select(maxFd + 1, &readable, NULL, NULL, &tv);
+    if (ready > 0 && FD_ISSET(wakeFd, &readable))
+    {
+        uint64_t count;
+        read(wakeFd, &count, sizeof(count)); // resets the counter
+    }
+    else if (ready < 0)
+        vTaskDelay(1); // e.g. the peer reset the socket: don't spin
+}
+
+uint32_t Automata::nextWakeIn(int &fd)
+{
+    unsigned long now = millis();
+    uint32_t wait = LOOP_MAX_SLEEP_MS;
+    auto until = [&](unsigned long at)
+    {
+        long left = (long)(at - now);
+        if (left < (long)wait)
+            wait = left > 0 ? left : 0;
+    };
+
+    until(previousMillis + getDelay());
+    if (batchSamples)
+        until(batchBlocked ? now + LOOP_POLL_MS : batchStartedAt + coalesceWindowMs);
+    if (!offlineQueue.empty() && isConnected())
+        until(drainNextAt);
+
+    // PubSubClient::loop() and WebSocketsClient::loop() handle one packet
+    // per call. Bytes already read into the client's buffer no longer
+    // show up in select(), so they get another pass right away.
+    fd = -1;
+    if (transport == TRANSPORT_MQTT && mqttClient.connected())
+    {
+        if (espClient.available())
+            wait = 0;
+        fd = espClient.fd();
+    }
+    else if (transport == TRANSPORT_WSS && mqttWS)
+    {
+        if (mqttWS->hasPendingWork() || mqttWS->hasBufferedInput())
+            wait = 0;
+        fd = mqttWS->socketFd();
+    }
+    if ((fd < 0 || wakeFd < 0) && wait > LOOP_POLL_MS)
+        wait = LOOP_POLL_MS;
+    return wait;
+}
+
+// ─── registerDevice ──────────────────────────────────────────
+//  The device description (everything except per-connection fields
+//  like IP and status) is hashed with FNV-1a. When the hash and
+//  deviceId stored in Preferences still match, only a small check-in
+//  is POSTed to "register/checkin"; the full document is sent when
+//  the description changed, the check-in fails, or the server answers
+//  with "register": true.
+// ─────────────────────────────────────────────────────────────
+namespace
+{
+    // Print sink that hashes instead of storing (FNV-1a, 32 bit)
+    class FnvPrint : public Print
+    {
+    public:
+        uint32_t hash = 2166136261u;
+        size_t write(uint8_t c) override
+        {
+            hash = (hash ^ c) * 16777619u;
+            return 1;
+        }
+        size_t write(const uint8_t *buf, size_t len) override
+        {
+            for (size_t i = 0; i < len; i++)
+                write(buf[i]);
+            return len;
+        }
+    };
+}
+
+void Automata::describeDevice(JsonDocument &doc)
+{
     doc["name"] = deviceName;
-    doc["deviceId"] = deviceId;
     doc["type"] = "sensor";
     doc["category"] = category;
     doc["updateInterval"] = d;
-    doc["status"] = "ONLINE";
-    doc["host"] = String(WiFi.getHostname());
     doc["macAddr"] = macAddr;
-    doc["reboot"] = false;
-    doc["sleep"] = false;
-    doc["accessUrl"] = "http://" + WiFi.localIP().toString();
 
     JsonArray attributes = doc.createNestedArray("attributes");
-    for (auto &attribute : attributeList)
+    for (size_t i = 0; i < attributeList.size(); i++)
     {
+        Attribute &attribute = attributeList[i];
         JsonObject attr = attributes.createNestedObject();
+        if (USE_KEY_IDS)
+            attr["id"] = i;
         attr["value"] = "";
         attr["displayName"] = attribute.displayName;
         attr["key"] = attribute.key;
@@ -367,50 +990,151 @@ void Automata::registerDevice()
         attr["valueDataType"] = "String";
     }
 
-    String jsonString;
-    serializeJson(doc, jsonString);
-    String res;
-    bool ret = USE_HTTPS ? sendHttps(jsonString, "register", res)
-                         : sendHttp(jsonString, "register", res);
-
-    if (ret)
+    if (USE_MSGPACK)
     {
-        JsonDocument resp;
-        if (deserializeJson(resp, res) == DeserializationError::Ok)
-        {
-            deviceId = resp["id"].as<String>();
-            isDeviceRegistered = true;
-            retryCount = 0;
-            preferences.putString("deviceId", deviceId);
-            Serial.println("[Automata] Device registered, id=" + deviceId);
+        JsonArray formats = doc.createNestedArray("payloadFormats");
+        formats.add("msgpack");
+        formats.add("json");
+    }
+}
 
-            vTaskDelay(pdMS_TO_TICKS(200));
+// Starts the (asynchronous) registration; returns false if one is
+// already in flight or the request could not be queued.
+bool Automata::registerDevice()
+{
+    if (registering)
+        return false;
 
-            if (transport == TRANSPORT_WSS)
-                wsConnect();
-            else
-                mqttConnect();
-        }
-    }
+    JsonDocument doc;
+    describeDevice(doc);
+    FnvPrint fnv;
+    serializeJson(doc, fnv);
+    char hash[9];
+    snprintf(hash, sizeof(hash), "%08lx", (unsigned long)fnv.hash);
+
+    String storedId = preferences.getString("deviceId", "");
+    if (storedId != "" && preferences.getString("regHash", "") == hash)
+        registering = checkIn(storedId, hash);
     else
+        registering = sendRegistration(std::move(doc), hash);
+    return registering;
+}
+
+bool Automata::sendRegistration(JsonDocument doc, const String &hash)
+{
+    Serial.printf("[Automata] Registering device (attempt %d)...\n", regRetries + 1);
+
+    doc["deviceId"] = deviceId;
+    doc["status"] = "ONLINE";
+    doc["host"] = String(WiFi.getHostname());
+    doc["reboot"] = false;
+    doc["sleep"] = false;
+    doc["accessUrl"] = "http://" + WiFi.localIP().toString();
+    doc["hash"] = hash;
+
+    return postAsync("register", std::move(doc), [this, hash](bool ok, const String &res)
+                     { registrationDone(ok, res, hash); });
+}
+
+void Automata::registrationDone(bool ok, const String &res, const String &hash)
+{
+    registering = false;
+
+    JsonDocument resp;
+    if (!ok || deserializeJson(resp, res) != DeserializationError::Ok)
     {
-        retryCount++;
-        Serial.printf("[Automata] Registration failed (attempt %d)\n", retryCount);
-        if (retryCount > 8)
+        regRetries++;
+        Serial.printf("[Automata] Registration failed (attempt %d)\n", regRetries);
+        if (regRetries > 8)
             Serial.println("[Automata] Max retries reached");
+        return;
     }
 
-    lastAttempt = millis();
+    String previousId = deviceId;
+    deviceId = resp["id"].as<String>();
+    uint32_t flags = (USE_MSGPACK && resp["payloadFormat"] == "msgpack" ? 0x01 : 0) |
+                     (USE_KEY_IDS && (resp["keyIds"] | false) ? 0x02 : 0);
+    applyRegFlags(flags);
+    regRetries = 0;
+    preferences.putString("deviceId", deviceId);
+    preferences.putString("regHash", hash);
+    preferences.putUInt("regFlags", flags);
+    Serial.println("[Automata] Device registered, id=" + deviceId);
+    onRegistered(previousId != deviceId);
 }
 
-// ─── TCP MQTT ─────────────────────────────────────────────────
-void Automata::mqttConnect()
+// "Still me": id, description hash and the per-connection fields.
+// Negotiated options come back from the last full registration. Falls
+// back to the full document if the check-in is refused.
+bool Automata::checkIn(const String &id, const String &hash)
 {
-    if (USE_SERVER_CREDS)
-        useServerCreds();
-
-    mqttClient.setServer(MQTT_HOST, MQTT_PORT);
-    mqttClient.setCallback([](char *topic, byte *payload, unsigned int length)
+    JsonDocument doc;
+    doc["deviceId"] = id;
+    doc["hash"] = hash;
+    doc["status"] = "ONLINE";
+    doc["host"] = String(WiFi.getHostname());
+    doc["accessUrl"] = "http://" + WiFi.localIP().toString();
+
+    return postAsync("register/checkin", std::move(doc), [this, id, hash](bool ok, const String &res)
+                     {
+        JsonDocument resp;
+        bool parsed = ok && deserializeJson(resp, res) == DeserializationError::Ok;
+        if (!ok || (parsed && (resp["register"] | false)))
+        {
+            Serial.println(ok ? "[Automata] Server asked for full registration"
+                              : "[Automata] Check-in failed, sending full registration");
+            JsonDocument full;
+            describeDevice(full);
+            registering = sendRegistration(std::move(full), hash);
+            return;
+        }
+
+        registering = false;
+        bool idChanged = deviceId != id;
+        deviceId = id;
+        applyRegFlags(preferences.getUInt("regFlags", 0));
+        Serial.println("[Automata] Checked in, id=" + deviceId);
+        onRegistered(idChanged); });
+}
+
+// Already connected (fast boot): only re-subscribe if the id changed.
+void Automata::onRegistered(bool idChanged)
+{
+    isDeviceRegistered = true;
+    registrationStale = false;
+    MDNS.addServiceTxt("esp32", "tcp", "deviceId", deviceId);
+    if (payloadFormat == FORMAT_MSGPACK)
+        Serial.println("[Automata] Backend accepted MessagePack payloads");
+    if (keyIdsConfirmed)
+        Serial.println("[Automata] Backend accepted attribute key ids");
+
+    if (isConnected())
+    {
+        if (!idChanged)
+            return;
+        if (transport == TRANSPORT_WSS)
+            wsSubscribed = false;
+        else
+            subscribeToDeviceTopics();
+        return;
+    }
+
+    connectTransport();
+}
+
+// ─── TCP MQTT ─────────────────────────────────────────────────
+void Automata::mqttConnect()
+{
+    // Fetch broker credentials first; loop() retries once they are in
+    if (USE_SERVER_CREDS && !serverCredsReady)
+    {
+        useServerCreds();
+        return;
+    }
+    serverCredsReady = false; // refresh them before the next attempt
+
+    mqttClient.setServer(MQTT_HOST, MQTT_PORT);
+    mqttClient.setCallback([](char *topic, byte *payload, unsigned int length)
                            { Automata::instance->mqttCallback(topic, payload, length); });
     mqttClient.setBufferSize(2048);
     mqttClient.setKeepAlive(30);
@@ -421,13 +1145,17 @@ void Automata::mqttConnect()
 
         if (mqttFailStart == 0)
             mqttFailStart = millis();
-        String clientId = "automata-" + convertToLowerAndUnderscore(deviceName) + "-" + macAddr;
+        String clientId = mqttClientId();
         Serial.printf("[Automata] MQTT connecting as: %s\n", clientId.c_str());
 
-        if (mqttClient.connect(clientId.c_str(), mqttUser, mqttPassword))
+        // PubSubClient doesn't expose the CONNACK session-present flag, so
+        // subscribeToDeviceTopics() still re-subscribes on this path.
+        if (mqttClient.connect(clientId.c_str(), mqttUser, mqttPassword,
+                               nullptr, 0, false, nullptr, !USE_PERSISTENT_SESSION))
         {
             mqttFailStart = 0;
             Serial.println("[Automata] MQTT connected");
+            resetDeltaState();
             subscribeToDeviceTopics();
         }
         else
@@ -450,53 +1178,15 @@ void Automata::useWebServer()
 void Automata::mqttCallback(char *topic, byte *payload, unsigned int length)
 {
     Serial.printf("[Automata] mqttCallback() topic=%s\n", topic);
-    String msg;
-    for (unsigned int i = 0; i < length; i++)
-        msg += (char)payload[i];
-
-    String topicStr = String(topic);
-    if (topicStr.endsWith("update/" + deviceId))
-    {
-        handleUpdate(msg);
-    }
-    else if (topicStr.endsWith("action/" + deviceId))
-    {
-        Serial.println("[Automata] Action received");
-        JsonDocument resp = parseString(msg);
-        Action action{resp};
-        if (_handleAction)
-            _handleAction(action);
-
-        bool rebootFlag = action.data["reboot"] | false;
-
-        JsonDocument ack = action.data; // echo back the same data for reference
-        ack["key"] = "actionAck";
-        ack["actionAck"] = "Success";
-        ack["status"] = "ok";
-        ack["device_id"] = deviceId;
-        ack["_cid"] = action.data["_cid"] | "";
-        String ackStr;
-        serializeJson(ack, ackStr);
-
-        // ACK back via whichever transport is active
-        publish(makeTopic("ackAction"), ackStr);
-        Serial.println("[Automata] Action ACK sent");
-
-        if (rebootFlag)
-        {
-            Serial.println("[Automata] Reboot flag — restarting");
-            if (transport == TRANSPORT_MQTT)
-                mqttClient.disconnect();
-            else if (mqttWS)
-                mqttWS->disconnect();
-            delay(200);
-            ESP.restart();
-        }
-    }
+    dispatchMessage(topic, strlen(topic), payload, length);
 }
 
 void Automata::subscribeToDeviceTopics()
 {
+    routeDeviceTopics();
+    for (auto &f : userFilters)
+        mqttClient.subscribe(f.first.c_str(), f.second);
+
     String updateTopic = makeTopic("update/" + deviceId);
     String actionTopic = makeTopic("action/" + deviceId);
     mqttClient.subscribe(updateTopic.c_str(), 1);
@@ -526,37 +1216,719 @@ String Automata::makeTopic(const String &subtopic)
 }
 
 // ─── sendLive / sendData / sendAction ────────────────────────
-void Automata::sendLive(JsonDocument data)
+//  Return the publish status so a caller producing data faster than
+//  the link can drain it sees MQTT_PUB_WOULD_BLOCK (see onWritable).
+//
+//  The document is serialized straight into the transport (see
+//  publishDoc). SSE always gets JSON with key names, rendered into
+//  payloadBuf only when a browser is listening.
+// ─────────────────────────────────────────────────────────────
+MQTTPublishStatus Automata::sendLive(JsonDocument &data)
+{
+    recordHistory(data);
+    if (!coalesceWindowMs)
+        return publishLive(data, USE_DELTA);
+
+    MQTTPublishStatus st = coalesceLive(data);
+    wake(); // loop() owns the flush deadline
+    return st;
+}
+
+MQTTPublishStatus Automata::publishLive(JsonDocument &data, bool delta)
+{
+    JsonDocument *out = delta ? deltaFor(liveDelta, data) : &data;
+    if (!out)
+        return MQTT_PUB_OK; // nothing moved past its deadband
+
+    JsonDocument &wire = keyIdsConfirmed ? encodeKeyIds(*out) : *out;
+    MQTTPublishStatus st = publishDoc(makeTopic("sendLiveData"), wire);
+    if (events.count() && serializeToBuffer(*out, FORMAT_JSON))
+        events.send(payloadBuf.data(), "live", millis());
+    if (delta)
+        commitDelta(liveDelta, *out, st);
+    return st;
+}
+
+MQTTPublishStatus Automata::sendData(JsonDocument &doc)
+{
+    JsonDocument *out = USE_DELTA ? deltaFor(dataDelta, doc) : &doc;
+    if (!out)
+        return MQTT_PUB_OK;
+
+    JsonDocument &wire = keyIdsConfirmed ? encodeKeyIds(*out) : *out;
+    MQTTPublishStatus st = publishDoc(makeTopic("sendData"), wire, false, 1);
+    if (USE_DELTA)
+        commitDelta(dataDelta, *out, st);
+    return st;
+}
+
+// ─── sendLive coalescing ─────────────────────────────────────
+//  With a window set, sendLive() only merges the sample into liveBatch;
+//  loop() publishes the batch (one PUBLISH, one SSE event) once the
+//  window since its first sample has elapsed. COALESCE_LAST keeps the
+//  newest value per key (and still goes through delta mode);
+//  COALESCE_SAMPLES keeps every sample with a timestamp;
+//  COALESCE_GORILLA keeps every numeric attribute sample, compressed.
+//
+//  A batch is flushed early before it would outgrow one PUBLISH. One
+//  the link refuses (MQTT_PUB_WOULD_BLOCK) is kept whole and retried
+//  from loop(); until it goes out, a sample that needs the room gets
+//  MQTT_PUB_WOULD_BLOCK back from sendLive(). A COALESCE_SAMPLES batch
+//  that still comes back MQTT_PUB_TOO_LARGE is sent in smaller parts.
+//
+//  sendLive() may run on any task while loop() flushes, so the batch
+//  state is only touched with liveLock held.
+// ─────────────────────────────────────────────────────────────
+void Automata::setCoalescing(uint32_t windowMs, CoalesceMode mode)
+{
+    LockGuard lock(liveLock);
+    flushLiveBatch(true);
+    if (batchSamples)
+    {
+        // Still refused: its layout belongs to the old mode
+        batchSamples = 0;
+        batchBlocked = false;
+        resetGorilla();
+    }
+    coalesceWindowMs = windowMs;
+    coalesceMode = mode;
+}
+
+// Epoch ms once NTP has synced, time since boot before that
+uint64_t Automata::epochMs()
+{
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+MQTTPublishStatus Automata::coalesceLive(JsonDocument &data)
+{
+    LockGuard lock(liveLock);
+    if (batchSamples && batchFull(data))
+    {
+        flushLiveBatch(true);
+        if (batchSamples)
+            return MQTT_PUB_WOULD_BLOCK;
+    }
+
+    if (batchSamples == 0)
+    {
+        liveBatch.clear();
+        batchStartedAt = millis();
+    }
+
+    if (coalesceMode == COALESCE_SAMPLES)
+    {
+        JsonObject sample = liveBatch["samples"].add<JsonObject>();
+        sample["ts"] = epochMs();
+        for (JsonPair kv : data.as<JsonObject>())
+            sample[kv.key()] = kv.value();
+    }
+    else
+    {
+        // COALESCE_GORILLA also keeps the newest value of every key here,
+        // for SSE and for keys that are not encoded
+        uint64_t ts = coalesceMode == COALESCE_GORILLA ? epochMs() : 0;
+        for (JsonPair kv : data.as<JsonObject>())
+        {
+            liveBatch[kv.key()] = kv.value();
+            int idx = ts ? attributeIndex(kv.key().c_str()) : -1;
+            if (idx >= 0 && kv.value().is<float>())
+                gorillaSeriesFor(idx).enc.add(ts, kv.value().as<float>());
+        }
+    }
+
+    if (++batchSamples >= COALESCE_MAX_SAMPLES && coalesceMode == COALESCE_SAMPLES)
+        flushLiveBatch(true);
+    return MQTT_PUB_QUEUED;
+}
+
+// True when `data` can't be merged without flushing first: a full
+// Gorilla series or sample count, or a batch that could outgrow the
+// MQTT-WS frame buffer. The size estimate is conservative (key ids and
+// delta mode only shrink the wire payload); PubSubClient streams
+// beginPublish() payloads of any length.
+//
+// On top of the two measured documents: ,"device_id":"<id>" (15 bytes
+// plus the id), up to 32 bytes of "enc"/"series" or "delta" envelope,
+// and for COALESCE_SAMPLES the new sample's "ts":<13 digits> with its
+// separators (20 bytes). MessagePack needs less for each.
+bool Automata::batchFull(JsonDocument &data)
+{
+    if (coalesceMode == COALESCE_GORILLA && gorillaFull())
+        return true;
+    if (coalesceMode == COALESCE_SAMPLES && batchSamples >= COALESCE_MAX_SAMPLES)
+        return true;
+    if (transport != TRANSPORT_WSS || !mqttWS)
+        return false;
+
+    bool pack = payloadFormat == FORMAT_MSGPACK;
+    size_t len = pack ? measureMsgPack(liveBatch) + measureMsgPack(data)
+                      : measureJson(liveBatch) + measureJson(data);
+    len += deviceId.length() + 15 + 32;
+    if (coalesceMode == COALESCE_SAMPLES)
+        len += 20;
+    if (coalesceMode == COALESCE_GORILLA)
+        len += gorillaSeriesBytes(data);
+    return len > mqttWS->maxPayload(makeTopic("sendLiveData").c_str());
+}
+
+void Automata::flushLiveBatch(bool force)
+{
+    LockGuard lock(liveLock);
+    if (batchSamples == 0)
+        return;
+    if (!force && millis() - batchStartedAt < coalesceWindowMs)
+        return;
+
+    MQTTPublishStatus st = coalesceMode == COALESCE_GORILLA
+                               ? publishGorillaBatch()
+                               : publishLive(liveBatch, USE_DELTA && coalesceMode == COALESCE_LAST);
+    if (st == MQTT_PUB_TOO_LARGE && coalesceMode == COALESCE_SAMPLES)
+        st = publishSampleParts();
+    else if (st == MQTT_PUB_TOO_LARGE)
+        handleError("Coalesced batch of " + String((unsigned)batchSamples) +
+                    " samples is too large for one publish, dropped");
+    batchBlocked = st == MQTT_PUB_WOULD_BLOCK;
+    if (batchBlocked)
+        return; // kept for the next loop()
+
+    batchSamples = 0;
+    liveBatch.clear();
+    resetGorilla();
+}
+
+// Sends a COALESCE_SAMPLES batch in parts: half of it, then smaller
+// while a part is still too large. Samples that went out are removed
+// from liveBatch, so a refused part keeps only the rest for loop(). A
+// single sample that can't fit any publish is logged and dropped.
+MQTTPublishStatus Automata::publishSampleParts()
+{
+    JsonArray samples = liveBatch["samples"];
+    size_t chunk = samples.size() > 1 ? samples.size() / 2 : 1;
+    MQTTPublishStatus st = MQTT_PUB_TOO_LARGE;
+    while (samples.size())
+    {
+        size_t n = chunk < samples.size() ? chunk : samples.size();
+        partDoc.clear();
+        JsonArray part = partDoc["samples"].to<JsonArray>();
+        for (size_t i = 0; i < n; i++)
+            part.add(samples[i]);
+
+        st = publishLive(partDoc, false);
+        if (st == MQTT_PUB_TOO_LARGE && n > 1)
+        {
+            chunk = n / 2;
+            continue;
+        }
+        if (st == MQTT_PUB_TOO_LARGE)
+        {
+            handleError("sendLive sample too large for one publish, dropped");
+            samples.remove(0);
+            chunk = samples.size();
+            continue;
+        }
+        if (st != MQTT_PUB_OK && st != MQTT_PUB_QUEUED)
+        {
+            batchSamples = samples.size();
+            return st;
+        }
+        for (size_t i = 0; i < n; i++)
+            samples.remove(0);
+    }
+    return st;
+}
+
+// ─── Gorilla-encoded batches ─────────────────────────────────
+//  Numeric attributes are delta-of-delta / XOR encoded (GorillaCodec.h,
+//  which the backend can build to decode) and sent base64'd under
+//  "series", keyed by attribute name or key id. Typically 3-5 bytes per
+//  sample instead of ~30 as JSON.
+// ─────────────────────────────────────────────────────────────
+Automata::GorillaSeries &Automata::gorillaSeriesFor(int attr)
+{
+    for (auto &s : gorillaSeries)
+        if (s.attr == attr)
+            return s;
+
+    gorillaSeries.emplace_back();
+    GorillaSeries &s = gorillaSeries.back();
+    s.attr = attr;
+    s.buf.resize(GORILLA_SERIES_BYTES);
+    s.enc.begin(s.buf.data(), s.buf.size());
+    return s;
+}
+
+// Base64 "series" entries once `data` is added: each key grows its
+// series by at most one sample, or starts one (header + sample)
+size_t Automata::gorillaSeriesBytes(JsonDocument &data)
+{
+    auto entry = [](size_t keyLen, size_t bytes)
+    { return keyLen + 4 + 4 * ((bytes + 2) / 3); };
+
+    size_t len = 0;
+    for (auto &s : gorillaSeries)
+        if (s.enc.count())
+            len += entry(attributeList[s.attr].key.length(), s.enc.size());
+    for (JsonPair kv : data.as<JsonObject>())
+        len += entry(kv.key().size(), GorillaEncoder::capacityFor(2));
+    return len;
+}
+
+bool Automata::gorillaFull()
+{
+    for (auto &s : gorillaSeries)
+        if (s.enc.full())
+            return true;
+    return false;
+}
+
+void Automata::resetGorilla()
+{
+    for (auto &s : gorillaSeries)
+        s.enc.begin(s.buf.data(), s.buf.size());
+}
+
+MQTTPublishStatus Automata::publishGorillaBatch()
+{
+    gorillaDoc.clear();
+    JsonObject series = gorillaDoc["series"].to<JsonObject>();
+    for (auto &s : gorillaSeries)
+        if (s.enc.count())
+            addEncodedSeries(series, s.attr, s.buf.data(), s.enc.size());
+
+    // Everything that wasn't encoded goes out as plain last values
+    for (JsonPair kv : liveBatch.as<JsonObject>())
+    {
+        int idx = attributeIndex(kv.key().c_str());
+        bool encoded = false;
+        for (auto &s : gorillaSeries)
+            if (s.attr == idx && s.enc.count())
+                encoded = true;
+        if (!encoded)
+            gorillaDoc[kv.key()] = kv.value();
+    }
+    gorillaDoc["enc"] = "gorilla";
+
+    JsonDocument &wire = keyIdsConfirmed ? encodeKeyIds(gorillaDoc) : gorillaDoc;
+    MQTTPublishStatus st = publishDoc(makeTopic("sendLiveData"), wire);
+    if (events.count() && serializeToBuffer(liveBatch, FORMAT_JSON))
+        events.send(payloadBuf.data(), "live", millis());
+    return st;
+}
+
+void Automata::addEncodedSeries(JsonObject series, int attr, const uint8_t *data, size_t length)
+{
+    size_t olen = 0;
+    b64Buf.resize(4 * ((length + 2) / 3) + 1);
+    mbedtls_base64_encode(b64Buf.data(), b64Buf.size(), &olen, data, length);
+    b64Buf[olen] = '\0';
+
+    // Passed as char* / String so the document copies both: `id` is on
+    // the stack and b64Buf is reused for the next series
+    char *value = (char *)b64Buf.data();
+    if (keyIdsConfirmed)
+    {
+        char id[8];
+        snprintf(id, sizeof(id), "%d", attr);
+        series[id] = value;
+    }
+    else
+        series[attributeList[attr].key] = value;
+}
+
+// Encodes one attribute's samples (timestamps ascending) and publishes
+// them on sendData as a single message.
+MQTTPublishStatus Automata::sendSeries(const String &key, const uint64_t *timestampsMs,
+                                       const float *values, size_t count)
+{
+    int idx = attributeIndex(key.c_str());
+    if (idx < 0 || count == 0 || count > 0xFFFF)
+    {
+        handleError("sendSeries: bad attribute or sample count for " + key);
+        return MQTT_PUB_FAILED;
+    }
+
+    std::vector<uint8_t> buf(GorillaEncoder::capacityFor(count));
+    GorillaEncoder enc;
+    enc.begin(buf.data(), buf.size());
+    for (size_t i = 0; i < count; i++)
+        enc.add(timestampsMs[i], values[i]);
+
+    JsonDocument doc;
+    doc["enc"] = "gorilla";
+    addEncodedSeries(doc["series"].to<JsonObject>(), idx, buf.data(), enc.size());
+    return publishDoc(makeTopic("sendData"), doc, false, 1);
+}
+
+// ─── History ─────────────────────────────────────────────────
+//  trackHistory() keeps a TimeSeries (raw ring + 1 min / 15 min
+//  min/max/avg rollups) for one numeric attribute, fed by every
+//  sendLive() sample. Timestamps are epoch seconds once NTP has synced.
+//
+//  GET /history?key=<key>&from=<epoch s>&res=<seconds>
+//    res < 60      → {"key":..,"res":0,"points":[[t,v],...]}
+//    res >= 60/900 → {"key":..,"res":60,"points":[[t,min,max,avg],...]}
+// ─────────────────────────────────────────────────────────────
+bool Automata::trackHistory(const String &key)
+{
+    int idx = attributeIndex(key.c_str());
+    if (idx < 0)
+    {
+        handleError("trackHistory: unknown attribute " + key);
+        return false;
+    }
+    if (history.size() < attributeList.size())
+        history.resize(attributeList.size(), nullptr);
+    if (!history[idx])
+        history[idx] = new TimeSeries();
+    return true;
+}
+
+void Automata::recordHistory(JsonDocument &data)
+{
+    if (history.empty())
+        return;
+    uint32_t now = time(nullptr);
+    for (JsonPair kv : data.as<JsonObject>())
+    {
+        if (!kv.value().is<float>())
+            continue;
+        int idx = attributeIndex(kv.key().c_str());
+        if (idx >= 0 && idx < (int)history.size() && history[idx])
+            addHistory(idx, now, kv.value().as<float>());
+    }
+}
+
+void Automata::addHistory(int idx, uint32_t t, float v)
+{
+    portENTER_CRITICAL(&historyMux);
+    history[idx]->add(t, v);
+    portEXIT_CRITICAL(&historyMux);
+}
+
+void Automata::sendHistory(AsyncWebServerRequest *request)
+{
+    if (!request->hasParam("key"))
+    {
+        request->send(400, "text/plain", "missing key");
+        return;
+    }
+    String key = request->getParam("key")->value();
+    int idx = attributeIndex(key.c_str());
+    if (idx < 0 || idx >= (int)history.size() || !history[idx])
+    {
+        request->send(404, "text/plain", "no history for " + key);
+        return;
+    }
+
+    uint32_t from = request->hasParam("from") ? request->getParam("from")->value().toInt() : 0;
+    uint32_t res = request->hasParam("res") ? request->getParam("res")->value().toInt() : 0;
+    uint8_t level = TimeSeries::levelFor(res);
+
+    // This runs on the AsyncTCP task while loop() keeps adding samples:
+    // copy the points under historyMux (room reserved beforehand, nothing
+    // may allocate inside the critical section), then stream the copy.
+    std::vector<TimeSeriesPoint> points;
+    points.reserve((TS_RAW_SAMPLES > TS_ROLLUP_SAMPLES ? TS_RAW_SAMPLES : TS_ROLLUP_SAMPLES) + 1);
+    portENTER_CRITICAL(&historyMux);
+    history[idx]->query(level, from, [&](const TimeSeriesPoint &p)
+                        { points.push_back(p); });
+    portEXIT_CRITICAL(&historyMux);
+
+    // No JsonDocument
+    AsyncResponseStream *stream = request->beginResponseStream("application/json");
+    stream->printf("{\"key\":\"%s\",\"res\":%lu,\"points\":[", key.c_str(),
+                   (unsigned long)TimeSeries::resolution(level));
+    bool first = true;
+    for (const TimeSeriesPoint &p : points)
+    {
+        if (!first)
+            stream->print(',');
+        first = false;
+        if (level == 0)
+            stream->printf("[%lu,%g]", (unsigned long)p.t, p.avg);
+        else
+            stream->printf("[%lu,%g,%g,%g]", (unsigned long)p.t, p.min, p.max, p.avg);
+    }
+    stream->print("]}");
+    request->send(stream);
+}
+
+// ─── Attribute key ids ───────────────────────────────────────
+//  With useKeyIds() each attribute is registered with "id" = its index
+//  in attributeList. Once the backend answers "keyIds": true,
+//  sendLive/sendData replace attribute keys with that id ("0", "1", ...)
+//  on the wire; other keys are left alone. /config also reports the
+//  ids, so the web UI can map them back to names.
+// ─────────────────────────────────────────────────────────────
+void Automata::useKeyIds() { USE_KEY_IDS = true; }
+
+int Automata::attributeIndex(const char *key)
+{
+    const Attribute *a = findAttribute(key);
+    return a ? a - &attributeList[0] : -1;
+}
+
+JsonDocument &Automata::encodeKeyIds(JsonDocument &doc)
+{
+    keyIdDoc.clear();
+    copyWithKeyIds(doc.as<JsonObject>(), keyIdDoc.to<JsonObject>());
+    return keyIdDoc;
+}
+
+void Automata::copyWithKeyIds(JsonObject src, JsonObject dst)
+{
+    char id[8];
+    for (JsonPair kv : src)
+    {
+        const char *key = kv.key().c_str();
+
+        // Coalesced batches: {"samples": [{...}, ...]}
+        if (strcmp(key, "samples") == 0 && kv.value().is<JsonArray>())
+        {
+            JsonArray out = dst["samples"].to<JsonArray>();
+            for (JsonVariant sample : kv.value().as<JsonArray>())
+                copyWithKeyIds(sample.as<JsonObject>(), out.add<JsonObject>());
+            continue;
+        }
+
+        int idx = attributeIndex(key);
+        if (idx < 0)
+        {
+            dst[kv.key()] = kv.value();
+            continue;
+        }
+        snprintf(id, sizeof(id), "%d", idx);
+        dst[id] = kv.value();
+    }
+}
+
+// ─── Delta telemetry ─────────────────────────────────────────
+//  Attributes registered with addAttribute() are compared against the
+//  value last published on the same stream (sendLive / sendData) and
+//  only sent when they moved past their deadband. Other keys ride
+//  along unchanged, and a delta message carries "delta": true.
+//
+//  A full document (keyframe) goes out every keyframeEvery messages,
+//  after (re)connecting, and after any publish that did not go through.
+// ─────────────────────────────────────────────────────────────
+void Automata::useDeltaTelemetry(uint16_t keyframeEverySamples)
 {
-    String payload = serializeJsonDoc(data);
-    publish(makeTopic("sendLiveData"), payload, false);
+    USE_DELTA = true;
+    keyframeEvery = keyframeEverySamples;
+    resetDeltaState();
+}
+
+void Automata::setDeadband(const String &key, float deadband)
+{
+    for (auto &a : attributeList)
+        if (a.key == key)
+            a.deadband = deadband;
+}
+
+void Automata::resetDeltaState()
+{
+    liveDelta.keyframe = true;
+    dataDelta.keyframe = true;
+}
+
+const Attribute *Automata::findAttribute(const char *key)
+{
+    for (auto &a : attributeList)
+        if (a.key == key)
+            return &a;
+    return nullptr;
+}
 
-    String json;
-    serializeJson(data, json);
-    events.send(json.c_str(), "live", millis());
+bool Automata::deltaChanged(JsonVariantConst last, JsonVariantConst value, float deadband)
+{
+    if (last.isNull())
+        return true;
+    if (deadband > 0 && last.is<float>() && value.is<float>())
+        return fabsf(value.as<float>() - last.as<float>()) > deadband;
+    return last != value;
 }
 
-void Automata::sendData(JsonDocument doc)
+// Returns what to publish: `doc` itself for a keyframe, deltaDoc for a
+// delta, or nullptr when no tracked attribute changed.
+JsonDocument *Automata::deltaFor(DeltaStream &stream, JsonDocument &doc)
 {
-    publish(makeTopic("sendData"), serializeJsonDoc(doc));
+    if (stream.keyframe || (keyframeEvery && stream.sinceKeyframe + 1 >= keyframeEvery))
+        return &doc;
+
+    deltaDoc.clear();
+    bool changed = false;
+    for (JsonPair kv : doc.as<JsonObject>())
+    {
+        JsonString key = kv.key(); // copied into deltaDoc, not linked
+        const Attribute *attr = findAttribute(key.c_str());
+        if (attr && !deltaChanged(stream.last[key], kv.value(), attr->deadband))
+            continue;
+        deltaDoc[key] = kv.value();
+        if (attr)
+            changed = true;
+    }
+    if (!changed)
+        return nullptr;
+
+    deltaDoc["delta"] = true;
+    return &deltaDoc;
+}
+
+// Remembers what the broker has seen. A refused publish forces the next
+// message to be a keyframe so the backend can't drift out of sync.
+void Automata::commitDelta(DeltaStream &stream, JsonDocument &sent, MQTTPublishStatus st)
+{
+    if (st != MQTT_PUB_OK && st != MQTT_PUB_QUEUED)
+    {
+        stream.keyframe = true;
+        return;
+    }
+
+    if (&sent == &deltaDoc)
+    {
+        stream.sinceKeyframe++;
+    }
+    else
+    {
+        stream.keyframe = false;
+        stream.sinceKeyframe = 0;
+    }
+
+    for (JsonPair kv : sent.as<JsonObject>())
+    {
+        JsonString key = kv.key(); // stream.last outlives the sent document
+        if (findAttribute(key.c_str()))
+            stream.last[key] = kv.value();
+    }
 }
 
-void Automata::sendAction(JsonDocument doc)
+MQTTPublishStatus Automata::sendAction(JsonDocument &doc)
 {
     Serial.print("[Automata] sendAction(): ");
-    publish(makeTopic("action"), serializeJsonDoc(doc));
+    return publishDoc(makeTopic("action"), doc);
 }
 
 // ─── Misc helpers ─────────────────────────────────────────────
-void Automata::addAttribute(String key, String displayName,
-                            String unit, String type, JsonDocument extras)
+int Automata::addAttribute(String key, String displayName,
+                           String unit, String type, JsonDocument extras)
+{
+    attributeList.push_back({key, displayName, unit, type, extras, 0.0f});
+    values.emplace_back();
+    return attributeList.size() - 1;
+}
+
+// ─── Typed attribute values ──────────────────────────────────
+//  set() writes into a fixed slot per attribute and marks it dirty only
+//  when the value actually changed. publishDirty() fills one reused
+//  document from the dirty slots and sends it through sendLive(), so
+//  it is measured and serialized straight into the transport by
+//  publishDoc(), and coalescing, delta mode, key ids and MessagePack
+//  all still apply.
+// ─────────────────────────────────────────────────────────────
+AttributeValue *Automata::slot(int idx, AttributeValueType type)
+{
+    if (idx < 0 || idx >= (int)values.size())
+        return nullptr;
+    AttributeValue *v = &values[idx];
+    if (v->type != type)
+    {
+        v->type = type;
+        v->dirty = true;
+    }
+    return v;
+}
+
+void Automata::set(int idx, float value)
+{
+    AttributeValue *v = slot(idx, VALUE_FLOAT);
+    if (v && (v->dirty || v->f != value))
+    {
+        v->f = value;
+        v->dirty = true;
+    }
+}
+
+void Automata::setInt(int idx, int32_t value)
+{
+    AttributeValue *v = slot(idx, VALUE_INT);
+    if (v && (v->dirty || v->i != value))
+    {
+        v->i = value;
+        v->dirty = true;
+    }
+}
+
+void Automata::set(int idx, bool value)
+{
+    AttributeValue *v = slot(idx, VALUE_BOOL);
+    if (v && (v->dirty || v->b != value))
+    {
+        v->b = value;
+        v->dirty = true;
+    }
+}
+
+// Longer strings are truncated to ATTR_STRING_SIZE - 1 characters.
+void Automata::set(int idx, const char *value)
 {
-    attributeList.push_back({key, displayName, unit, type, extras});
+    AttributeValue *v = slot(idx, VALUE_STRING);
+    if (v && (v->dirty || strncmp(v->s, value, sizeof(v->s) - 1) != 0))
+    {
+        strlcpy(v->s, value, sizeof(v->s));
+        v->dirty = true;
+    }
+}
+
+MQTTPublishStatus Automata::publishDirty(bool all)
+{
+    slotDoc.clear();
+    bool any = false;
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        AttributeValue &v = values[i];
+        if (v.type == VALUE_NONE || !(v.dirty || all))
+            continue;
+        // const char * keys are stored as pointers into attributeList
+        const char *key = attributeList[i].key.c_str();
+        switch (v.type)
+        {
+        case VALUE_FLOAT:
+            slotDoc[key] = v.f;
+            break;
+        case VALUE_INT:
+            slotDoc[key] = v.i;
+            break;
+        case VALUE_BOOL:
+            slotDoc[key] = v.b;
+            break;
+        default:
+            slotDoc[key] = (const char *)v.s;
+            break;
+        }
+        any = true;
+    }
+    if (!any)
+        return MQTT_PUB_OK;
+
+    MQTTPublishStatus st = sendLive(slotDoc);
+    if (st == MQTT_PUB_OK || st == MQTT_PUB_QUEUED)
+        for (auto &v : values)
+            v.dirty = false;
+    return st;
 }
 
 void Automata::onActionReceived(HandleAction cb) { _handleAction = cb; }
 void Automata::delayedUpdate(HandleDelay hd) { _handleDelay = hd; }
 int Automata::getDelay() { return d; }
+void Automata::setMaxInflight(uint8_t n)
+{
+    maxInflight = n;
+    if (mqttWS)
+        mqttWS->setMaxInflight(n);
+}
 
 String Automata::getMacAddress() { return WiFi.macAddress(); }
 Preferences Automata::getPreferences() { return preferences; }
@@ -577,14 +1949,87 @@ char Automata::toLowerCase(char c)
     return (c >= 'A' && c <= 'Z') ? c + 32 : c;
 }
 
+// One allocation of the exact size instead of growing a String while
+// serializing into it.
 String Automata::serializeJsonDoc(JsonDocument &doc)
 {
-    doc["device_id"] = deviceId;
+    if (!(USE_MQTT5 && transport == TRANSPORT_WSS))
+        doc["device_id"] = deviceId;
     String output;
+    output.reserve(measureJson(doc));
     serializeJson(doc, output);
     return output;
 }
 
+// Same content as serializeJsonDoc(), written into payloadBuf without a
+// temporary String (NUL-terminated for JSON). The buffer only grows, so
+// steady-state telemetry does not allocate. device_id is removed again
+// afterwards so the caller's document is left as it was.
+size_t Automata::serializeToBuffer(JsonDocument &doc, PayloadFormat format)
+{
+    bool addId = !(USE_MQTT5 && transport == TRANSPORT_WSS) && doc["device_id"].isNull();
+    if (addId)
+        doc["device_id"] = deviceId;
+
+    if (payloadBuf.empty())
+        payloadBuf.resize(JSON_BUFFER_SIZE);
+    size_t len = writePayload(doc, format);
+    if (len + 1 >= payloadBuf.size())
+    {
+        // May have been truncated: size it exactly and write again
+        len = format == FORMAT_MSGPACK ? measureMsgPack(doc) : measureJson(doc);
+        payloadBuf.resize(len + 1);
+        len = writePayload(doc, format);
+    }
+
+    if (addId)
+        doc.remove("device_id");
+    return len;
+}
+
+size_t Automata::writePayload(JsonDocument &doc, PayloadFormat format)
+{
+    if (format == FORMAT_MSGPACK)
+        return serializeMsgPack(doc, payloadBuf.data(), payloadBuf.size());
+    return serializeJson(doc, payloadBuf.data(), payloadBuf.size());
+}
+
+// A MessagePack map starts with 0x80-0x8f, 0xde or 0xdf; none of those
+// can start a JSON document.
+bool Automata::isMsgPack(const uint8_t *payload, size_t length)
+{
+    if (length == 0)
+        return false;
+    uint8_t b = payload[0];
+    return (b & 0xF0) == 0x80 || b == 0xDE || b == 0xDF;
+}
+
+// ─── Payload format ──────────────────────────────────────────
+//  useMessagePack() only advertises the capability in the register
+//  payload ("payloadFormats"). The device switches once the backend
+//  answers with "payloadFormat": "msgpack" and otherwise keeps JSON.
+//  Inbound actions are accepted in either format.
+// ─────────────────────────────────────────────────────────────
+void Automata::useMessagePack() { USE_MSGPACK = true; }
+
+PayloadFormat Automata::getPayloadFormat() { return payloadFormat; }
+
+// In-place equivalent of parseString()'s trim() + replace("\\", "").
+size_t Automata::sanitizeJson(char *buf, size_t len)
+{
+    size_t start = 0;
+    while (start < len && isspace((unsigned char)buf[start]))
+        start++;
+    while (len > start && isspace((unsigned char)buf[len - 1]))
+        len--;
+
+    size_t out = 0;
+    for (size_t i = start; i < len; i++)
+        if (buf[i] != '\\')
+            buf[out++] = buf[i];
+    return out;
+}
+
 JsonDocument Automata::parseString(String str)
 {
     JsonDocument resp;
@@ -600,17 +2045,17 @@ void Automata::configureWiFi()
 {
     JsonDocument req;
     req["wifi"] = "get";
-    String jsonString;
-    serializeJson(req, jsonString);
-    String res;
-    bool ret = USE_HTTPS ? sendHttps(jsonString, "wifiList", res)
-                         : sendHttp(jsonString, "wifiList", res);
-
-    if (ret)
-        preferences.putString("wifiList", res);
-    else
-        Serial.println("[Automata] Failed to fetch WiFi list");
+    postAsync("wifiList", std::move(req), [this](bool ok, const String &res)
+              {
+        if (ok)
+            preferences.putString("wifiList", res);
+        else
+            Serial.println("[Automata] Failed to fetch WiFi list");
+        applyWiFiList(); });
+}
 
+void Automata::applyWiFiList()
+{
     String config = preferences.getString("wifiList", "");
     if (config == "")
         return;
@@ -634,85 +2079,329 @@ void Automata::configureWiFi()
 
 void Automata::useServerCreds()
 {
+    if (serverCredsPending)
+        return;
+
     JsonDocument doc;
     doc["mqtt"] = true;
     doc["deviceId"] = deviceId;
-    String jsonString;
-    serializeJson(doc, jsonString);
-    String res;
-    bool ret = USE_HTTPS ? sendHttps(jsonString, "serverCreds", res)
-                         : sendHttp(jsonString, "serverCreds", res);
-
-    JsonDocument resp;
-    if (deserializeJson(resp, res) == DeserializationError::Ok)
-    {
-        MQTT_HOST = resp["MQTT_HOST"].as<String>().c_str();
-        MQTT_PORT = resp["MQTT_PORT"].as<int>();
-    }
+    serverCredsPending = postAsync("serverCreds", std::move(doc), [this](bool ok, const String &res)
+                                   {
+        serverCredsPending = false;
+        serverCredsReady = true; // connect even if the fetch failed, as before
+        JsonDocument resp;
+        if (ok && deserializeJson(resp, res) == DeserializationError::Ok)
+        {
+            // Keep the string alive: MQTT_HOST points into it
+            serverMqttHost = resp["MQTT_HOST"].as<String>();
+            MQTT_HOST = serverMqttHost.c_str();
+            MQTT_PORT = resp["MQTT_PORT"].as<int>();
+        } });
 }
-bool Automata::loginDevice()
+
+void Automata::loginDevice()
 {
     JsonDocument doc;
 
     doc["macAddr"] = macAddr;
     doc["deviceSecret"] = deviceSecret;
 
-    String req;
-    serializeJson(doc, req);
+    queueHttp("device/login", std::move(doc), true, 0, [this](bool ok, const String &response)
+              {
+        if (!ok)
+            return;
+        JsonDocument resp;
+        deserializeJson(resp, response);
+        jwtToken = resp["token"].as<String>(); });
+}
 
+// ─── Async HTTP ──────────────────────────────────────────────
+//  Requests are queued to a worker task that runs the blocking
+//  backend calls; finished jobs come back on a second queue and
+//  their callbacks run from loop(), on the same task as everything
+//  else, so they can touch Automata state freely. loop() keeps
+//  servicing MQTT and actions while a request is in flight.
+// ─────────────────────────────────────────────────────────────
+struct Automata::HttpJob
+{
+    String endpoint;
+    JsonDocument body; // serialized by the worker, straight into the socket
+    bool https;
+    uint32_t timeoutMs;
+    HttpCallback done;
+    bool ok = false;
     String response;
+};
 
-    if(!sendHttps(req, "device/login", response))
+bool Automata::postAsync(const String &endpoint, JsonDocument body, HttpCallback done,
+                         uint32_t timeoutMs)
+{
+    return queueHttp(endpoint, std::move(body), USE_HTTPS, timeoutMs, done);
+}
+
+bool Automata::queueHttp(const String &endpoint, JsonDocument body, bool https,
+                         uint32_t timeoutMs, HttpCallback done)
+{
+    if (!httpRequests)
+    {
+        httpRequests = xQueueCreate(HTTP_QUEUE_DEPTH, sizeof(HttpJob *));
+        httpDone = xQueueCreate(HTTP_QUEUE_DEPTH + 1, sizeof(HttpJob *));
+        xTaskCreate([](void *params)
+                    { static_cast<Automata *>(params)->httpWorker(); },
+                    "automataHttp", HTTP_TASK_STACK, this, 2, NULL);
+    }
+
+    HttpJob *job = new HttpJob();
+    job->endpoint = endpoint;
+    job->body = std::move(body);
+    job->https = https;
+    job->timeoutMs = timeoutMs;
+    job->done = done;
+    if (xQueueSend(httpRequests, &job, 0) != pdTRUE)
+    {
+        Serial.println("[HTTP] Request queue full, dropped " + endpoint);
+        delete job;
         return false;
+    }
+    return true;
+}
 
-    JsonDocument resp;
-    deserializeJson(resp, response);
+void Automata::httpWorker()
+{
+    HttpJob *job;
+    for (;;)
+    {
+        if (xQueueReceive(httpRequests, &job, portMAX_DELAY) != pdTRUE)
+            continue;
+        job->ok = job->https ? sendHttps(job->body, job->endpoint, job->response, job->timeoutMs)
+                             : sendHttp(job->body, job->endpoint, job->response, job->timeoutMs);
+        xQueueSend(httpDone, &job, portMAX_DELAY);
+        wake();
+    }
+}
 
-    jwtToken = resp["token"].as<String>();
+void Automata::pollHttp()
+{
+    HttpJob *job;
+    while (httpDone && xQueueReceive(httpDone, &job, 0) == pdTRUE)
+    {
+        if (job->done)
+            job->done(job->ok, job->response);
+        delete job;
+    }
+}
 
-    return true;
+// ─── Backend HTTP ────────────────────────────────────────────
+//  One persistent connection per scheme, only used by the HTTP worker
+//  task. The request is written by hand so the job's document can be
+//  serialized straight into the socket: Content-Length comes from
+//  measureJson(), then serializeJson() runs through a ChunkedPrint.
+//  The connection stays open unless the server closes it.
+// ─────────────────────────────────────────────────────────────
+bool Automata::sendHttps(JsonDocument &body, const String &endpoint, String &result,
+                         uint32_t timeoutMs)
+{
+    backendTls.setInsecure();
+    return postBackend(backendTls, 443, endpoint, body, result, timeoutMs ? timeoutMs : 10000);
 }
-bool Automata::sendHttps(const String &output, const String &endpoint, String &result)
+
+bool Automata::sendHttp(JsonDocument &body, const String &endpoint, String &result,
+                        uint32_t timeoutMs)
 {
-    WiFiClientSecure client;
-    HTTPClient http;
-    result = "";
+    return postBackend(backendTcp, PORT, endpoint, body, result, timeoutMs ? timeoutMs : 5000);
+}
 
-    String url = "https://" + String(HOST) + "/api/v1/main/" + endpoint;
-    client.setInsecure();
-    if (!http.begin(client, url))
-        return false;
+namespace
+{
+    bool timedOut(uint32_t deadline) { return (int32_t)(millis() - deadline) >= 0; }
 
-    http.addHeader("Content-Type", "application/json");
-    http.setTimeout(10000);
-    int code = http.POST(output);
-    Serial.printf("[HTTP] Response code: %d\n", code);
-    if (code > 0)
+    // Waits for the next byte; -1 once the peer closed or time ran out
+    int readByte(WiFiClient &client, uint32_t deadline)
     {
-        result = http.getString();
-        Serial.printf("[HTTP] Response: %s\n", result.c_str());
+        while (!timedOut(deadline))
+        {
+            int c = client.read();
+            if (c >= 0)
+                return c;
+            if (!client.connected() && !client.available())
+                return -1;
+            delay(1);
+        }
+        return -1;
     }
-    else
+
+    // One header line without its CRLF
+    bool readLine(WiFiClient &client, String &line, uint32_t deadline)
     {
-        Serial.printf("[HTTP] Error: %s\n", http.errorToString(code).c_str());
+        line = "";
+        for (;;)
+        {
+            int c = readByte(client, deadline);
+            if (c < 0)
+                return false;
+            if (c == '\n')
+                break;
+            if (c != '\r')
+                line += (char)c;
+        }
+        return true;
+    }
+
+    // `length` bytes, or everything up to the close when it is negative
+    bool readBody(WiFiClient &client, String &result, long length, uint32_t deadline)
+    {
+        uint8_t buf[128];
+        if (length > 0)
+            result.reserve(result.length() + length);
+        while (length != 0 && !timedOut(deadline))
+        {
+            size_t want = (length < 0 || length > (long)sizeof(buf)) ? sizeof(buf) : length;
+            int n = client.read(buf, want);
+            if (n <= 0)
+            {
+                if (!client.connected() && !client.available())
+                    return length < 0;
+                delay(1);
+                continue;
+            }
+            result.concat((const char *)buf, n);
+            if (length > 0)
+                length -= n;
+        }
+        return length == 0;
+    }
+
+    enum ResponseStatus
+    {
+        RESPONSE_OK,
+        RESPONSE_CLOSED, // peer closed before sending a byte: request not taken
+        RESPONSE_FAILED, // timed out, malformed or cut short
+    };
+
+    // Sets `code` and `result` only for RESPONSE_OK. Leaves the connection
+    // open only if the response was read completely and the server keeps
+    // it alive.
+    ResponseStatus readResponse(WiFiClient &client, String &result, uint32_t timeoutMs, int &code)
+    {
+        uint32_t deadline = millis() + timeoutMs;
+        String line;
+        if (!readLine(client, line, deadline))
+        {
+            client.stop();
+            return (line.length() || timedOut(deadline)) ? RESPONSE_FAILED : RESPONSE_CLOSED;
+        }
+        if (!line.startsWith("HTTP/1.") || line.length() < 12)
+        {
+            client.stop();
+            return RESPONSE_FAILED;
+        }
+        int status = line.substring(9, 12).toInt();
+        bool keepAlive = line[7] == '1';
+
+        long length = -1;
+        bool chunked = false;
+        while (readLine(client, line, deadline) && line.length())
+        {
+            int colon = line.indexOf(':');
+            if (colon < 0)
+                continue;
+            String name = line.substring(0, colon);
+            String value = line.substring(colon + 1);
+            name.toLowerCase();
+            value.trim();
+            value.toLowerCase();
+            if (name == "content-length")
+                length = value.toInt();
+            else if (name == "transfer-encoding")
+                chunked = value.indexOf("chunked") >= 0;
+            else if (name == "connection")
+                keepAlive = value.indexOf("close") < 0;
+        }
+
+        bool complete = false;
+        if (chunked)
+        {
+            while (readLine(client, line, deadline))
+            {
+                long size = strtol(line.c_str(), nullptr, 16);
+                if (size == 0)
+                {
+                    while (readLine(client, line, deadline) && line.length())
+                        ; // trailers
+                    complete = true;
+                    break;
+                }
+                if (!readBody(client, result, size, deadline) || !readLine(client, line, deadline))
+                    break;
+            }
+        }
+        else
+        {
+            complete = readBody(client, result, length, deadline);
+            keepAlive = keepAlive && length >= 0;
+        }
+
+        if (!complete || !keepAlive)
+            client.stop();
+        if (!complete)
+        {
+            result = "";
+            return RESPONSE_FAILED;
+        }
+        code = status;
+        return RESPONSE_OK;
     }
-    http.end();
-    return (code >= 200 && code < 300);
 }
 
-bool Automata::sendHttp(const String &output, const String &endpoint, String &result)
+bool Automata::postBackend(WiFiClient &client, uint16_t port, const String &endpoint,
+                           JsonDocument &body, String &result, uint32_t timeoutMs)
 {
-    HTTPClient http;
-    result = "";
-    http.begin("http://" + String(HOST) + ":" + String(PORT) + "/api/v1/main/" + endpoint);
-    http.addHeader("Content-Type", "application/json");
-    http.setTimeout(5000);
-    int code = http.POST(output);
-    if (code > 0)
-        result = http.getString();
+    char host[80];
+    if (port == 80 || port == 443)
+        strlcpy(host, HOST, sizeof(host));
     else
-        Serial.printf("[HTTP] POST failed: %s\n", http.errorToString(code).c_str());
-    http.end();
+        snprintf(host, sizeof(host), "%s:%u", HOST, port);
+
+    result = "";
+    int code = 0;
+    for (uint8_t attempt = 0; attempt < 2; attempt++)
+    {
+        bool reused = client.connected();
+        if (!reused && !client.connect(HOST, port, timeoutMs))
+        {
+            Serial.printf("[HTTP] Connect to %s failed\n", host);
+            return false;
+        }
+
+        size_t head = client.printf("POST /api/v1/main/%s HTTP/1.1\r\n"
+                                    "Host: %s\r\n"
+                                    "Content-Type: application/json\r\n"
+                                    "Content-Length: %u\r\n"
+                                    "Connection: keep-alive\r\n\r\n",
+                                    endpoint.c_str(), host, (unsigned)measureJson(body));
+        ChunkedPrint out(client);
+        serializeJson(body, out);
+        out.finish();
+
+        ResponseStatus st = RESPONSE_CLOSED;
+        if (head && out.ok())
+            st = readResponse(client, result, timeoutMs, code);
+        else
+            client.stop();
+        if (st == RESPONSE_OK)
+            break;
+
+        // A kept-alive socket the server closed while idle fails the write
+        // or closes without a byte of response: the request was not taken,
+        // so it is sent once more on a fresh connection. Never after a
+        // timeout or a partial response, the server may have acted on it.
+        if (!reused || st != RESPONSE_CLOSED)
+            break;
+    }
+
+    Serial.printf("[HTTP] Response code: %d\n", code);
+    if (code == 0)
+        Serial.println("[HTTP] POST " + endpoint + " failed");
     return (code >= 200 && code < 300);
 }
 
@@ -729,12 +2418,8 @@ void Automata::handleWebServer()
 
     server.on("/action", HTTP_POST, [](AsyncWebServerRequest *) {}, NULL, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t, size_t)
               {
-                  String body = "";
-                  for (size_t i = 0; i < len; i++) body += (char)data[i];
-                  DynamicJsonDocument doc(512);
-                  deserializeJson(doc, body);
                   Action action;
-                  action.data = doc;
+                  deserializeJson(action.data, (const char *)data, len);
                   if (Automata::instance->_handleAction)
                       Automata::instance->_handleAction(action);
                   request->send(200, "text/plain", "OK"); });
@@ -746,14 +2431,18 @@ void Automata::handleWebServer()
                   for (auto &a : Automata::instance->attributeList)
                   {
                       JsonObject obj = arr.createNestedObject();
+                      obj["id"]    = &a - &Automata::instance->attributeList[0];
                       obj["key"]   = a.key;
                       obj["label"] = a.displayName;
                       obj["unit"]  = a.unit;
                       obj["type"]  = a.type;
                   }
-                  String res;
-                  serializeJson(doc, res);
-                  request->send(200, "application/json", res); });
+                  AsyncResponseStream *stream = request->beginResponseStream("application/json");
+                  serializeJson(doc, *stream);
+                  request->send(stream); });
+
+    server.on("/history", HTTP_GET, [](AsyncWebServerRequest *request)
+              { Automata::instance->sendHistory(request); });
 
     server.addHandler(&events);
     server.begin();
@@ -5,16 +5,21 @@
 #include <WiFi.h>
 #include <WiFiMulti.h>
 #include <WiFiClient.h>
+#include <WiFiClientSecure.h>
 #include <PubSubClient.h>
 #include <Preferences.h>
-#include <HTTPClient.h>
 #include <ArduinoJson.h>
 #include <AsyncTCP.h>
 #include <ESPAsyncWebServer.h>
 #include <ArduinoOTA.h>
 #include <vector>
+#include <type_traits>
 #include <ESPmDNS.h>
 #include "MQTTWebSocket.h" // ← replaces SimpleStomp.h
+#include "PublishQueue.h"
+#include "TopicTrie.h"
+#include "TimeSeries.h"
+#include "GorillaCodec.h"
 #include <esp_task_wdt.h>
 #define USE_WEBSERVER 1
 #define USE_REGISTER_DEVICE 1
@@ -29,6 +34,50 @@
 #define USE_REGISTER_DEVICE 1
 #endif
 
+// Offline publish buffer (see setOfflineQueue / setDrainRate)
+#ifndef OFFLINE_QUEUE_BYTES
+#define OFFLINE_QUEUE_BYTES 8192
+#endif
+
+#ifndef OFFLINE_QUEUE_MESSAGES
+#define OFFLINE_QUEUE_MESSAGES 64
+#endif
+
+// Async HTTP: queued requests and worker task stack
+#ifndef HTTP_QUEUE_DEPTH
+#define HTTP_QUEUE_DEPTH 4
+#endif
+
+#ifndef HTTP_TASK_STACK
+#define HTTP_TASK_STACK 8192
+#endif
+
+// Event-driven loop: longest sleep with nothing due, and the polling
+// interval used while there is no broker socket to watch
+#ifndef LOOP_MAX_SLEEP_MS
+#define LOOP_MAX_SLEEP_MS 500
+#endif
+
+#ifndef LOOP_POLL_MS
+#define LOOP_POLL_MS 10
+#endif
+
+// Initial size of the telemetry serialization buffer (grows on demand)
+#ifndef JSON_BUFFER_SIZE
+#define JSON_BUFFER_SIZE 512
+#endif
+
+// COALESCE_SAMPLES: a window is flushed early once it holds this many samples
+#ifndef COALESCE_MAX_SAMPLES
+#define COALESCE_MAX_SAMPLES 32
+#endif
+
+// COALESCE_GORILLA: encoded bytes per attribute per window (flushed early when
+// full, or when all series together would outgrow one MQTT-WS frame)
+#ifndef GORILLA_SERIES_BYTES
+#define GORILLA_SERIES_BYTES 512
+#endif
+
 struct Action
 {
   JsonDocument data;
@@ -40,6 +89,19 @@ enum PubSubTransport
   TRANSPORT_WSS
 };
 
+enum PayloadFormat
+{
+  FORMAT_JSON,
+  FORMAT_MSGPACK
+};
+
+enum CoalesceMode
+{
+  COALESCE_LAST,   // one flat object, last write wins per key
+  COALESCE_SAMPLES, // {"samples": [{"ts": <epoch ms>, ...}, ...]}
+  COALESCE_GORILLA  // {"enc": "gorilla", "series": {key: base64}, ...}
+};
+
 struct Attribute
 {
   String key;
@@ -47,6 +109,35 @@ struct Attribute
   String unit;
   String type;
   JsonDocument extras;
+  float deadband; // delta telemetry: minimum change worth publishing
+};
+
+// Typed value slot for an attribute, indexed like attributeList.
+// Strings up to ATTR_STRING_SIZE - 1 chars are stored inline.
+#ifndef ATTR_STRING_SIZE
+#define ATTR_STRING_SIZE 16
+#endif
+
+enum AttributeValueType : uint8_t
+{
+  VALUE_NONE,
+  VALUE_FLOAT,
+  VALUE_INT,
+  VALUE_BOOL,
+  VALUE_STRING
+};
+
+struct AttributeValue
+{
+  AttributeValueType type = VALUE_NONE;
+  bool dirty = false;
+  union
+  {
+    float f;
+    int32_t i;
+    bool b;
+  };
+  char s[ATTR_STRING_SIZE];
 };
 
 const char index_html[] PROGMEM = R"rawliteral(
@@ -478,6 +569,7 @@ const char index_html[] PROGMEM = R"rawliteral(
 <script>
   // ── SSE live data ──────────────────────────────────────────
   const grid = document.getElementById('data-grid');
+  const keyNames = {};   // numeric key id → attribute key, filled from /config
 
   if (window.EventSource) {
     const src = new EventSource('/events');
@@ -492,8 +584,13 @@ const char index_html[] PROGMEM = R"rawliteral(
 
     src.addEventListener('live', e => {
       try {
-        const data = JSON.parse(e.data);
-        Object.entries(data).forEach(([key, value]) => {
+        let data = JSON.parse(e.data);
+        // Coalesced batch: apply the samples in order, latest wins
+        if (Array.isArray(data.samples)) data = Object.assign({}, ...data.samples);
+        delete data.ts;
+        delete data.delta;
+        Object.entries(data).forEach(([id, value]) => {
+          const key = keyNames[id] ?? id;
           const valEl  = document.getElementById('val_' + key);
           const toggle = document.getElementById('sw_' + key);
           const slider = document.getElementById('sl_' + key);
@@ -559,6 +656,7 @@ const char index_html[] PROGMEM = R"rawliteral(
       let dataHTML   = '';
 
       data.attributes.forEach(attr => {
+        keyNames[attr.id] = attr.key;
         const types = attr.type.split('|');
 
         if (types.includes('ACTION')) {
@@ -618,8 +716,15 @@ const char index_html[] PROGMEM = R"rawliteral(
 class Automata
 {
 public:
-  using HandleAction = std::function<void(Action)>;
+  using HandleAction = std::function<void(Action &)>;
   using HandleDelay = std::function<void(void)>;
+  using HttpCallback = std::function<void(bool ok, const String &response)>;
+  using HandleMessage = std::function<void(const String &topic, const String &payload)>;
+  // Zero-copy: topic/payload point into the receive buffer and are only
+  // valid during the call. Read-only: other handlers for the same topic
+  // see the same bytes.
+  using HandleMessageBytes = std::function<void(const char *topic, size_t topicLen,
+                                                const uint8_t *payload, size_t length)>;
 
   Automata(String deviceName, String category = "", const char *HOST = "", int PORT = 0);
   Automata(String deviceName, String category = "", const char *HOST = "", int PORT = 0,
@@ -627,23 +732,66 @@ public:
 
   void begin();
   Preferences getPreferences();
-  void addAttribute(String key, String displayName, String unit,
+  int addAttribute(String key, String displayName, String unit,
                     String type = "INFO", JsonDocument extras = JsonDocument());
-  void registerDevice();
-  void sendLive(JsonDocument data);
-  void sendData(JsonDocument doc);
-  void sendAction(JsonDocument doc);
+  bool registerDevice();
+  bool postAsync(const String &endpoint, JsonDocument body, HttpCallback done,
+                 uint32_t timeoutMs = 0);
+  void wake();
+  MQTTPublishStatus sendLive(JsonDocument &data);
+  MQTTPublishStatus sendData(JsonDocument &doc);
+  MQTTPublishStatus sendAction(JsonDocument &doc);
+  MQTTPublishStatus sendLive(JsonDocument &&data) { return sendLive(data); }
+  MQTTPublishStatus sendData(JsonDocument &&doc) { return sendData(doc); }
+  MQTTPublishStatus sendAction(JsonDocument &&doc) { return sendAction(doc); }
   void onActionReceived(HandleAction cb);
+  bool subscribe(const String &filter, HandleMessage handler, uint8_t qos = 1);
+  bool subscribe(const String &filter, HandleMessageBytes handler, uint8_t qos = 1);
   void handleError(String error);
   void wsSubscribeTopics();
   void delayedUpdate(HandleDelay hd);
+  void onPublishComplete(MQTTPublishCallback cb);
+  void setMaxInflight(uint8_t n);
+  MQTTPublishStats getPublishStats();
+  MQTTConnectionStats getConnectionStats();
+  void onWritable(MQTTWritableCallback cb);
+  bool isWritable();
+  void setOfflineQueue(size_t maxBytes, uint16_t maxMessages,
+                       PublishDropPolicy policy = DROP_OLDEST);
+  void setDrainRate(uint16_t messagesPerSecond, uint16_t jitterMs = 2000);
+  OfflineQueueStats getOfflineQueueStats();
+  void useDeltaTelemetry(uint16_t keyframeEverySamples = 30);
+  void setCoalescing(uint32_t windowMs, CoalesceMode mode = COALESCE_LAST);
+  void useMessagePack();
+  void useKeyIds();
+
+  // Typed attribute values: O(1), no JsonDocument in user code.
+  // `idx` is the value returned by addAttribute(). Every integer type
+  // (int, unsigned, long, uint8_t, ...) is stored as int32_t.
+  void set(int idx, float value);
+  void set(int idx, double value) { set(idx, (float)value); }
+  void set(int idx, bool value);
+  void set(int idx, const char *value);
+  void set(int idx, const String &value) { set(idx, value.c_str()); }
+  template <typename T, typename std::enable_if<std::is_integral<T>::value, int>::type = 0>
+  void set(int idx, T value) { setInt(idx, (int32_t)value); }
+  MQTTPublishStatus publishDirty(bool all = false);
+  bool trackHistory(const String &key);
+  MQTTPublishStatus sendSeries(const String &key, const uint64_t *timestampsMs,
+                               const float *values, size_t count);
+  PayloadFormat getPayloadFormat();
+  void setDeadband(const String &key, float deadband);
   void handleUpdate(const String &msg);
   void handleAction(const String &msg);
+  void handleAction(const uint8_t *payload, size_t length);
   bool isConnected();
   void useMQTT();
   void useWSS();
   void useCreds();
   void useHTTPS();
+  void useMQTT5(uint32_t messageExpirySec = 0);
+  void usePersistentSession(uint32_t sessionExpirySec = 3600);
+  void useFastBoot();
   void useWebServer();
   int getDelay();
   AsyncWebServer &getWebserver();
@@ -676,6 +824,12 @@ private:
   PubSubClient mqttClient;
   volatile uint32_t lastLoopTick = 0;
 
+  // ── Event-driven loop ─────────────────────
+  TaskHandle_t loopTask = nullptr;
+  volatile int wakeFd = -1; // eventfd written by wake(), -1 = notify loopTask instead
+  uint32_t nextWakeIn(int &fd);
+  void waitForWork(uint32_t ms, int fd);
+
   unsigned long wifiLostTime = 0;
   bool wifiWasConnected = false;
 
@@ -685,6 +839,9 @@ private:
 
   HandleAction _handleAction = nullptr;
   HandleDelay _handleDelay = nullptr;
+  MQTTPublishCallback _handlePublishComplete = nullptr;
+  MQTTWritableCallback _handleWritable = nullptr;
+  uint8_t maxInflight = MQTT_WS_MAX_INFLIGHT;
 
   std::vector<Attribute> attributeList;
   unsigned long previousMillis = 0;
@@ -698,30 +855,179 @@ private:
   char toLowerCase(char c);
   void keepWiFiAlive();
   void setOTA();
-  bool sendHttp(const String &output, const String &endpoint, String &result);
-  bool sendHttps(const String &output, const String &endpoint, String &result);
-  bool loginDevice();
+  bool sendHttp(JsonDocument &body, const String &endpoint, String &result,
+                uint32_t timeoutMs = 0);
+  bool sendHttps(JsonDocument &body, const String &endpoint, String &result,
+                 uint32_t timeoutMs = 0);
+  bool postBackend(WiFiClient &client, uint16_t port, const String &endpoint,
+                   JsonDocument &body, String &result, uint32_t timeoutMs);
+  WiFiClientSecure backendTls; // persistent backend connections,
+  WiFiClient backendTcp;       // owned by the HTTP worker task
+  void loginDevice();
+  void applyWiFiList();
+  void describeDevice(JsonDocument &doc);
+  bool checkIn(const String &id, const String &hash);
+  bool sendRegistration(JsonDocument doc, const String &hash);
+  void registrationDone(bool ok, const String &res, const String &hash);
+  bool registering = false;
+  uint8_t regRetries = 0;
+  bool serverCredsPending = false;
+  bool serverCredsReady = false;
+  String serverMqttHost;
+
+  // ── Async HTTP ────────────────────────────
+  struct HttpJob;
+  QueueHandle_t httpRequests = nullptr;
+  QueueHandle_t httpDone = nullptr;
+  bool queueHttp(const String &endpoint, JsonDocument body, bool https,
+                 uint32_t timeoutMs, HttpCallback done);
+  void httpWorker();
+  void pollHttp();
+  void onRegistered(bool idChanged);
+  void applyRegFlags(uint32_t flags);
+  void connectTransport();
   void getConfig();
 
   // ── TCP MQTT (PubSubClient) ───────────────
   void mqttConnect();
   void mqttCallback(char *topic, byte *payload, unsigned int length);
   void subscribeToDeviceTopics();
+  String mqttClientId();
 
   // ── MQTT-over-WebSocket (MQTTWebSocket) ───
   MQTTWebSocket *mqttWS = nullptr; // ← replaces SimpleStomp*
   bool wsSubscribed = false;
   void wsConnect();
 
+  // ── Topic dispatch ────────────────────────
+  struct MessageRoute
+  {
+    HandleMessage text;
+    HandleMessageBytes bytes;
+  };
+  TopicTrie<MessageRoute> subscriptions;
+  std::vector<std::pair<String, uint8_t>> userFilters;
+  String routedDeviceId;
+  bool addSubscription(const String &filter, const MessageRoute &route, uint8_t qos);
+  void routeDeviceTopics();
+  void dispatchMessage(const char *topic, size_t topicLen, const uint8_t *payload, size_t length);
+
+  // ── Offline publish queue ─────────────────
+  PublishQueue offlineQueue;
+  uint16_t drainRate = 10; // messages per second
+  uint16_t drainJitterMs = 2000;
+  unsigned long drainNextAt = 0;
+  unsigned long drainStartedAt = 0;
+  uint8_t drainFailures = 0;
+  bool wasConnected = false;
+  bool draining = false;
+  void drainOfflineQueue();
+
+  // ── Delta telemetry ───────────────────────
+  struct DeltaStream
+  {
+    JsonDocument last; // attribute values the broker has seen
+    uint16_t sinceKeyframe = 0;
+    bool keyframe = true;
+  };
+  bool USE_DELTA = false;
+  uint16_t keyframeEvery = 30;
+  DeltaStream liveDelta;
+  DeltaStream dataDelta;
+  JsonDocument deltaDoc;
+  void resetDeltaState();
+  const Attribute *findAttribute(const char *key);
+  static bool deltaChanged(JsonVariantConst last, JsonVariantConst value, float deadband);
+  JsonDocument *deltaFor(DeltaStream &stream, JsonDocument &doc);
+  void commitDelta(DeltaStream &stream, JsonDocument &sent, MQTTPublishStatus st);
+
+  // ── sendLive coalescing ───────────────────
+  uint32_t coalesceWindowMs = 0; // 0 = every sendLive publishes
+  CoalesceMode coalesceMode = COALESCE_LAST;
+  JsonDocument liveBatch;
+  uint16_t batchSamples = 0;
+  unsigned long batchStartedAt = 0;
+  bool batchBlocked = false; // last flush got MQTT_PUB_WOULD_BLOCK
+  SemaphoreHandle_t liveLock = xSemaphoreCreateRecursiveMutex(); // guards the batch state
+  JsonDocument partDoc;
+  MQTTPublishStatus publishLive(JsonDocument &data, bool delta);
+  MQTTPublishStatus coalesceLive(JsonDocument &data);
+  MQTTPublishStatus publishSampleParts();
+  bool batchFull(JsonDocument &data);
+  void flushLiveBatch(bool force = false);
+
+  // ── Gorilla-encoded batches ───────────────
+  struct GorillaSeries
+  {
+    int attr;
+    std::vector<uint8_t> buf;
+    GorillaEncoder enc;
+  };
+  std::vector<GorillaSeries> gorillaSeries;
+  JsonDocument gorillaDoc;
+  std::vector<unsigned char> b64Buf;
+  GorillaSeries &gorillaSeriesFor(int attr);
+  bool gorillaFull();
+  size_t gorillaSeriesBytes(JsonDocument &data);
+  void resetGorilla();
+  MQTTPublishStatus publishGorillaBatch();
+  void addEncodedSeries(JsonObject series, int attr, const uint8_t *data, size_t length);
+  static uint64_t epochMs();
+
   // ── Shared helpers ────────────────────────
-  void publish(const String &topic, const String &payload, bool retained = false);
+  MQTTPublishStatus publish(const String &topic, const String &payload, bool retained = false, uint8_t qos = 0);
+  MQTTPublishStatus publish(const String &topic, const uint8_t *data, size_t length,
+                            bool retained = false, uint8_t qos = 0);
+  MQTTPublishStatus publishDoc(const String &topic, JsonDocument &doc,
+                               bool retained = false, uint8_t qos = 0);
+  MQTTPublishStatus queueOffline(const String &topic, const uint8_t *data, size_t length,
+                                 bool retained, uint8_t qos);
+  MQTTPublishStatus transportPublish(const char *topic, const uint8_t *payload, size_t length,
+                                     bool retained, uint8_t qos);
+  MQTTPublishStatus streamPublish(const char *topic, JsonDocument &doc,
+                                  bool retained, uint8_t qos);
   String makeTopic(const String &subtopic);
   String serializeJsonDoc(JsonDocument &doc);
+  size_t serializeToBuffer(JsonDocument &doc, PayloadFormat format);
+  size_t writePayload(JsonDocument &doc, PayloadFormat format);
+  static bool isMsgPack(const uint8_t *payload, size_t length);
+  std::vector<char> payloadBuf; // reused by sendLive/sendData/sendAction/ACKs
+  std::vector<char> actionBuf;  // action payloads with backslashes to strip
+
+  // ── Typed attribute values ────────────────
+  std::vector<AttributeValue> values; // same order as attributeList
+  JsonDocument slotDoc;
+  AttributeValue *slot(int idx, AttributeValueType type);
+  void setInt(int idx, int32_t value);
+
+  // ── History (/history) ────────────────────
+  std::vector<TimeSeries *> history; // per attribute index, nullptr = not tracked
+  portMUX_TYPE historyMux = portMUX_INITIALIZER_UNLOCKED; // rings are read by the AsyncTCP task
+  void addHistory(int idx, uint32_t t, float v);
+  void recordHistory(JsonDocument &data);
+  void sendHistory(AsyncWebServerRequest *request);
+
+  // ── Attribute key ids ─────────────────────
+  bool USE_KEY_IDS = false;
+  bool keyIdsConfirmed = false; // backend accepted ids in its register response
+  JsonDocument keyIdDoc;
+  int attributeIndex(const char *key);
+  JsonDocument &encodeKeyIds(JsonDocument &doc);
+  void copyWithKeyIds(JsonObject src, JsonObject dst);
   JsonDocument parseString(String str);
+  static size_t sanitizeJson(char *buf, size_t len);
 
   PubSubTransport transport = TRANSPORT_MQTT;
+  bool USE_MQTT5 = false;
+  bool USE_MSGPACK = false;
+  PayloadFormat payloadFormat = FORMAT_JSON; // confirmed by registerDevice()
+  bool USE_PERSISTENT_SESSION = false;
+  uint32_t sessionExpiry = 3600;
+  uint32_t messageExpiry = 0;
   bool USE_HTTPS = false;
   bool USE_SERVER_CREDS = false;
+  bool FAST_BOOT = false;
+  bool registrationStale = false; // fast boot: cached id not yet revalidated
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,247 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+
+// ─────────────────────────────────────────────
+//  GorillaCodec — compact encoding of (timestamp, float) sample runs
+//
+//  Timestamps are delta-of-delta encoded, values are XORed with the
+//  previous value (Facebook Gorilla, adapted to 32-bit floats and ms
+//  timestamps). Plain C++ with no Arduino dependency, so the backend
+//  can build the same header to decode.
+//
+//  Stream layout (bits, MSB first):
+//    [count:16][t0:64][v0:32] then per sample:
+//    dod   '0' | '10'+7 | '110'+9 | '1110'+12 | '1111'+32  (biased)
+//    value '0' (same) | '10'+bits in previous window
+//          | '11'+lead:5+len-1:5+bits
+// ─────────────────────────────────────────────
+class GorillaEncoder {
+public:
+  // Worst case for one sample after the first: 36 + 44 bits
+  static const size_t MAX_SAMPLE_BITS = 80;
+  static const size_t HEADER_BITS     = 16 + 64 + 32;
+
+  void begin(uint8_t* buf, size_t cap) {
+    _buf   = buf;
+    _cap   = cap;
+    _bits  = 0;
+    _count = 0;
+    if (!_buf || _cap < 2) return;
+    _bits = 16;                       // count is patched in as we go
+    memset(_buf, 0, _cap);
+    _patchCount();
+  }
+
+  // Appends one sample; returns false (and writes nothing) if it does
+  // not fit. Timestamps must not go backwards, and gaps must stay under
+  // ~24 days (delta-of-delta is at most 32 bits).
+  bool add(uint64_t tMs, float v) {
+    uint32_t bits;
+    memcpy(&bits, &v, 4);
+
+    if (_count == 0) {
+      if (!_buf || _cap * 8 < HEADER_BITS) return false;
+      _write(tMs, 64);
+      _write(bits, 32);
+      _prevT     = tMs;
+      _prevDelta = 0;
+      _prevBits  = bits;
+      _lead      = 0xFF;             // no window yet
+    } else {
+      if (_count == 0xFFFF || _bits + MAX_SAMPLE_BITS > _cap * 8) return false;
+      _writeTime(tMs);
+      _writeValue(bits);
+    }
+    _count++;
+    _patchCount();
+    return true;
+  }
+
+  uint16_t count() const { return _count; }
+  size_t   size()  const { return (_bits + 7) / 8; }
+
+  // True if add() may refuse the next sample
+  bool full() const {
+    return _count && (_count == 0xFFFF || _bits + MAX_SAMPLE_BITS > _cap * 8);
+  }
+
+  // Bytes needed to always fit `n` samples
+  static size_t capacityFor(size_t n) {
+    return (HEADER_BITS + (n ? n - 1 : 0) * MAX_SAMPLE_BITS + 7) / 8;
+  }
+
+private:
+  uint8_t* _buf       = nullptr;
+  size_t   _cap       = 0;
+  size_t   _bits      = 0;
+  uint16_t _count     = 0;
+  uint64_t _prevT     = 0;
+  int64_t  _prevDelta = 0;
+  uint32_t _prevBits  = 0;
+  uint8_t  _lead      = 0;
+  uint8_t  _trail     = 0;
+
+  void _write(uint64_t value, uint8_t n) {
+    while (n--) {
+      if ((value >> n) & 1) _buf[_bits >> 3] |= 0x80 >> (_bits & 7);
+      _bits++;
+    }
+  }
+
+  void _patchCount() {
+    _buf[0] = _count >> 8;
+    _buf[1] = _count & 0xFF;
+  }
+
+  void _writeTime(uint64_t tMs) {
+    int64_t delta = (int64_t)(tMs - _prevT);
+    int64_t dod   = delta - _prevDelta;
+    _prevT     = tMs;
+    _prevDelta = delta;
+
+    if (dod == 0) {
+      _write(0, 1);
+    } else if (dod >= -63 && dod <= 64) {
+      _write(0x2, 2);
+      _write(dod + 63, 7);
+    } else if (dod >= -255 && dod <= 256) {
+      _write(0x6, 3);
+      _write(dod + 255, 9);
+    } else if (dod >= -2047 && dod <= 2048) {
+      _write(0xE, 4);
+      _write(dod + 2047, 12);
+    } else {
+      _write(0xF, 4);
+      _write((uint32_t)(int32_t)dod, 32);
+    }
+  }
+
+  void _writeValue(uint32_t bits) {
+    uint32_t x = bits ^ _prevBits;
+    _prevBits = bits;
+    if (x == 0) {
+      _write(0, 1);
+      return;
+    }
+
+    uint8_t lead  = __builtin_clz(x);
+    uint8_t trail = __builtin_ctz(x);
+
+    if (_lead != 0xFF && lead >= _lead && trail >= _trail) {
+      _write(0x2, 2);
+      _write(x >> _trail, 32 - _lead - _trail);
+      return;
+    }
+
+    uint8_t len = 32 - lead - trail;
+    _write(0x3, 2);
+    _write(lead, 5);
+    _write(len - 1, 5);
+    _write(x >> trail, len);
+    _lead  = lead;
+    _trail = trail;
+  }
+};
+
+class GorillaDecoder {
+public:
+  GorillaDecoder(const uint8_t* buf, size_t len) : _buf(buf), _len(len) {
+    _count = len >= 2 ? ((uint16_t)buf[0] << 8) | buf[1] : 0;
+    _bits  = 16;
+  }
+
+  uint16_t count() const { return _count; }
+
+  // Next sample; false at the end or on a truncated stream.
+  bool next(uint64_t& tMs, float& v) {
+    if (_read >= _count) return false;
+
+    if (_read == 0) {
+      if (!_get(64, _prevT) || !_get32(_prevBits)) return false;
+      _prevDelta = 0;
+    } else if (!_readTime() || !_readValue()) {
+      return false;
+    }
+
+    _read++;
+    tMs = _prevT;
+    memcpy(&v, &_prevBits, 4);
+    return true;
+  }
+
+private:
+  const uint8_t* _buf;
+  size_t         _len;
+  size_t         _bits;
+  uint16_t       _count;
+  uint16_t       _read      = 0;
+  uint64_t       _prevT     = 0;
+  int64_t        _prevDelta = 0;
+  uint32_t       _prevBits  = 0;
+  uint8_t        _lead      = 0;
+  uint8_t        _trail     = 0;
+
+  bool _get(uint8_t n, uint64_t& out) {
+    if (_bits + n > _len * 8) return false;
+    out = 0;
+    while (n--) {
+      out = (out << 1) | ((_buf[_bits >> 3] >> (7 - (_bits & 7))) & 1);
+      _bits++;
+    }
+    return true;
+  }
+
+  bool _get32(uint32_t& out) {
+    uint64_t v;
+    if (!_get(32, v)) return false;
+    out = (uint32_t)v;
+    return true;
+  }
+
+  bool _readTime() {
+    // Count leading 1s of the control prefix (max 4)
+    uint8_t ones = 0;
+    uint64_t b;
+    while (ones < 4) {
+      if (!_get(1, b)) return false;
+      if (!b) break;
+      ones++;
+    }
+
+    int64_t  dod = 0;
+    uint64_t v;
+    switch (ones) {
+      case 0: break;
+      case 1: if (!_get(7, v))  return false; dod = (int64_t)v - 63;   break;
+      case 2: if (!_get(9, v))  return false; dod = (int64_t)v - 255;  break;
+      case 3: if (!_get(12, v)) return false; dod = (int64_t)v - 2047; break;
+      default:
+        if (!_get(32, v)) return false;
+        dod = (int32_t)(uint32_t)v;
+        break;
+    }
+    _prevDelta += dod;
+    _prevT     += _prevDelta;
+    return true;
+  }
+
+  bool _readValue() {
+    uint64_t b, v;
+    if (!_get(1, b)) return false;
+    if (!b) return true;                // unchanged
+
+    if (!_get(1, b)) return false;
+    if (b) {
+      uint64_t lead, len;
+      if (!_get(5, lead) || !_get(5, len)) return false;
+      if (lead + len + 1 > 32) return false;
+      _lead  = lead;
+      _trail = 32 - lead - (len + 1);
+    }
+    uint8_t n = 32 - _lead - _trail;
+    if (!_get(n, v)) return false;
+    _prevBits ^= (uint32_t)v << _trail;
+    return true;
+  }
+};
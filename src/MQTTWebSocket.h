@@ -3,6 +3,7 @@
 #include <functional>
 #include <vector>
 #include <map>
+#include "RecordRing.h"
 
 // ─────────────────────────────────────────────
 //  MQTT v3.1.1 Packet Types
@@ -20,6 +21,85 @@
 #define MQTT_QOS0        0x00
 #define MQTT_QOS1        0x02
 
+// ─────────────────────────────────────────────
+//  MQTT 5.0 property identifiers (subset we send or read)
+// ─────────────────────────────────────────────
+#define MQTT_PROP_MESSAGE_EXPIRY     0x02
+#define MQTT_PROP_SESSION_EXPIRY     0x11
+#define MQTT_PROP_ASSIGNED_CLIENT_ID 0x12
+#define MQTT_PROP_REASON_STRING      0x1F
+#define MQTT_PROP_RECEIVE_MAXIMUM    0x21
+#define MQTT_PROP_TOPIC_ALIAS_MAX    0x22
+#define MQTT_PROP_TOPIC_ALIAS        0x23
+#define MQTT_PROP_USER_PROPERTY      0x26
+#define MQTT_PROP_MAX_PACKET_SIZE    0x27
+
+// Upper bound on outbound topic aliases we keep per connection
+#ifndef MQTT_WS_MAX_TOPIC_ALIASES
+  #define MQTT_WS_MAX_TOPIC_ALIASES 16
+#endif
+
+// ── TX buffer ─────────────────────────────────
+// PUBLISH packets are encoded in place into one preallocated buffer.
+// The first WEBSOCKETS_MAX_HEADER_SIZE bytes are kept free so sendBIN()
+// can prepend the WS frame header itself (headerToPayload) instead of
+// malloc'ing a copy of the packet on every send.
+#ifndef MQTT_WS_TX_BUFFER_SIZE
+  #define MQTT_WS_TX_BUFFER_SIZE 2048
+#endif
+
+// ── RX reassembly buffer ──────────────────────
+// Bounds a single MQTT packet that arrives split across WS frames.
+// Packets that are complete inside one frame are parsed straight from the
+// frame and never copied here; larger packets are skipped.
+#ifndef MQTT_WS_RX_BUFFER_SIZE
+  #define MQTT_WS_RX_BUFFER_SIZE 2048
+#endif
+
+// ── QoS 1 in-flight window ────────────────────
+// Unacked QoS 1 PUBLISHes are kept (by packet id) and resent with DUP set
+// after MQTT_WS_RETRY_MS and on every reconnect. The window size can be
+// lowered at runtime with setMaxInflight().
+#ifndef MQTT_WS_MAX_INFLIGHT
+  #define MQTT_WS_MAX_INFLIGHT 16
+#endif
+#ifndef MQTT_WS_RETRY_MS
+  #define MQTT_WS_RETRY_MS 10000
+#endif
+#ifndef MQTT_WS_MAX_RETRIES
+  #define MQTT_WS_MAX_RETRIES 5
+#endif
+
+// ── Outbound queue / backpressure ─────────────
+// PUBLISHes that can't go out immediately wait here (encoded, in order).
+// loop() sends at most MQTT_WS_TX_BUDGET bytes from it per call, and a
+// sendBIN() that blocks longer than MQTT_WS_SEND_STALL_MS marks the
+// socket saturated until the next loop().
+#ifndef MQTT_WS_TX_QUEUE_SIZE
+  #define MQTT_WS_TX_QUEUE_SIZE 4096
+#endif
+#ifndef MQTT_WS_TX_BUDGET
+  #define MQTT_WS_TX_BUDGET 4096
+#endif
+#ifndef MQTT_WS_SEND_STALL_MS
+  #define MQTT_WS_SEND_STALL_MS 50
+#endif
+
+// ── Reconnect ─────────────────────────────────
+// WebSocketsClient opens a fresh TLS client for every attempt and keeps
+// no session cache, so instead of resuming we spread reconnects out: the
+// retry interval doubles from MIN to MAX after each attempt, with
+// ±MQTT_WS_RECONNECT_JITTER % random jitter, and resets on CONNACK.
+#ifndef MQTT_WS_RECONNECT_MIN_MS
+  #define MQTT_WS_RECONNECT_MIN_MS 2000
+#endif
+#ifndef MQTT_WS_RECONNECT_MAX_MS
+  #define MQTT_WS_RECONNECT_MAX_MS 60000
+#endif
+#ifndef MQTT_WS_RECONNECT_JITTER
+  #define MQTT_WS_RECONNECT_JITTER 50
+#endif
+
 // ── Debug toggle ──────────────────────────────
 #define MQTT_WS_DEBUG 1
 #if MQTT_WS_DEBUG
@@ -29,8 +109,64 @@
 #endif
 
 typedef std::function<void(const String& topic, const String& payload)> MQTTMessageCallback;
+// Zero-copy variant: read-only views into the receive buffer, valid only
+// for the duration of the call. onMessage() sees the same bytes.
+typedef std::function<void(const char* topic, size_t topicLen,
+                           const uint8_t* payload, size_t length)>       MQTTRawMessageCallback;
 typedef std::function<void()>                                            MQTTConnectCallback;
 typedef std::function<void()>                                            MQTTDisconnectCallback;
+typedef std::function<void(uint16_t packetId, bool acked)>               MQTTPublishCallback;
+typedef std::function<void(const String& filter, uint8_t returnCode)>    MQTTSubscribeCallback;
+typedef std::function<void()>                                            MQTTWritableCallback;
+
+enum MQTTPublishStatus {
+  MQTT_PUB_OK,             // handed to the socket
+  MQTT_PUB_QUEUED,         // accepted, will be sent from loop() / after reconnect
+  MQTT_PUB_WOULD_BLOCK,    // outbound queue or QoS 1 window full — try later
+  MQTT_PUB_NOT_CONNECTED,
+  MQTT_PUB_TOO_LARGE,
+  MQTT_PUB_FAILED
+};
+
+struct MQTTPublishStats {
+  uint32_t sent        = 0;   // QoS 1 publishes handed to the socket
+  uint32_t acked       = 0;   // PUBACK received
+  uint32_t retransmits = 0;   // resent with DUP
+  uint32_t expired     = 0;   // gave up after MQTT_WS_MAX_RETRIES
+  uint32_t rejected    = 0;   // MQTT 5 PUBACK with a failure reason code
+  uint32_t wouldBlock  = 0;   // publishes refused with MQTT_PUB_WOULD_BLOCK
+  uint32_t txDropped   = 0;   // queued packets discarded on disconnect
+};
+
+struct MQTTConnectionStats {
+  uint32_t connects     = 0;   // accepted CONNACKs
+  uint32_t attempts     = 0;   // WebSocket connect attempts
+  uint32_t handshakeMs  = 0;   // last attempt → WS open (TCP + TLS + upgrade)
+  uint32_t connackMs    = 0;   // last CONNECT → CONNACK
+  uint32_t recoveryMs   = 0;   // last disconnect → CONNACK
+  uint32_t recoveryHeap = 0;   // lowest free heap seen during the last recovery
+};
+
+// Gives MQTTWebSocket access to the socket under the WebSocket and to
+// the connect bookkeeping of WebSocketsClient::loop()
+class MQTTWSClient : public WebSocketsClient {
+public:
+#ifdef ESP32
+  // WiFiClient::fd() is not virtual, and a TLS client keeps its socket
+  // in its own context: ask it directly
+  int fd() {
+    if (_client.ssl) return _client.ssl->fd();
+    return _client.tcp ? _client.tcp->fd() : -1;
+  }
+#else
+  int fd() { return -1; }   // WiFiClient::fd() is ESP32-only: callers poll
+#endif
+  // Received bytes the WiFiClient has buffered (decrypted, under TLS)
+  int  available()    { return _client.tcp ? _client.tcp->available() : 0; }
+  bool tcpConnected() { return clientIsConnected(&_client); }
+  // Stamped by loop() each time a TCP connect fails
+  unsigned long lastConnectFail() const { return _lastConnectionFail; }
+};
 
 class MQTTWebSocket {
 public:
@@ -60,7 +196,8 @@ public:
       _onWsEvent(type, payload, length);
     });
 
-    _ws.setReconnectInterval(5000);
+    _reconnectDelay = MQTT_WS_RECONNECT_MIN_MS;
+    _ws.setReconnectInterval(_jittered(_reconnectDelay));
 
     // FIX 2: WS-level heartbeat well under Cloudflare's 100s idle timeout
     _ws.enableHeartbeat(20000, 3000, 2);
@@ -73,13 +210,55 @@ public:
     _pass     = pass ? String(pass) : "";
   }
 
+  // ─── MQTT 5 (opt-in) ──────────────────────
+  // Level 5 enables topic aliases for QoS 0 publishes (up to the broker's
+  // Topic Alias Maximum), and adds the message expiry and user properties
+  // below to every PUBLISH. Call before begin().
+  void setProtocolVersion(uint8_t version) { _mqtt5 = (version == 5); }
+  bool isMQTT5() const                     { return _mqtt5; }
+  void setMessageExpiry(uint32_t seconds)  { _messageExpiry = seconds; }
+
+  void setUserProperty(const String& key, const String& value) {
+    for (auto& up : _userProps) {
+      if (up.first == key) { up.second = value; return; }
+    }
+    _userProps.push_back({key, value});
+  }
+  void clearUserProperties() { _userProps.clear(); }
+
+  // ─── Persistent session ───────────────────
+  // With clean session off the broker keeps our subscriptions and queues
+  // QoS 1 messages while we are away. `expirySec` is only sent on MQTT 5
+  // (3.1.1 sessions last until the broker drops them). Call before begin().
+  void setPersistentSession(bool persistent, uint32_t expirySec = 3600) {
+    _cleanSession  = !persistent;
+    _sessionExpiry = expirySec;
+  }
+  bool sessionPresent() const { return _sessionPresent; }
+
   void onMessage(MQTTMessageCallback cb)       { _msgCb = cb; }
+  void onMessageRaw(MQTTRawMessageCallback cb) { _rawCb = cb; }
   void onConnect(MQTTConnectCallback cb)       { _conCb = cb; }
   void onDisconnect(MQTTDisconnectCallback cb) { _disCb = cb; }
+  void onPublishComplete(MQTTPublishCallback cb) { _pubCb = cb; }
+  void onSubscribeResult(MQTTSubscribeCallback cb) { _subCb = cb; }
+
+  void setMaxInflight(uint8_t n) {
+    _maxInflight = (n == 0 || n > MQTT_WS_MAX_INFLIGHT) ? MQTT_WS_MAX_INFLIGHT : n;
+    _inflightLimit = _maxInflight;
+  }
+  uint8_t                 inflight() const     { return _inflightCount; }
+  uint16_t                lastPacketId() const { return _lastPacketId; }
+  const MQTTPublishStats& stats() const        { return _stats; }
+  const MQTTConnectionStats& connectionStats() const { return _connStats; }
 
   // ─── Loop ─────────────────────────────────
   void loop() {
-    _ws.loop();
+    if (_wsReady) {
+      _ws.loop();
+    } else {
+      _loopConnecting();
+    }
 
     // FIX 3: Deferred MQTT CONNECT — wait one full loop() after WStype_CONNECTED
     // so the SSL layer is fully flushed before writing MQTT bytes
@@ -96,42 +275,219 @@ public:
         _lastPing = now;
       }
     }
+
+    if (_connected && _inflightCount) _retryInflight(false);
+
+    _saturated = false;
+    if (_connected) _flushTx();
   }
 
   // ─── Publish ──────────────────────────────
   bool publish(const String& topic, const String& payload,
                bool retain = false, uint8_t qos = 0) {
-    if (!_connected) return false;
+    return publish(topic.c_str(), (const uint8_t*)payload.c_str(),
+                   payload.length(), retain, qos);
+  }
 
-    std::vector<uint8_t> body;
-    _appendString(body, topic);
+  bool publish(const char* topic, const uint8_t* payload, size_t length,
+               bool retain = false, uint8_t qos = 0) {
+    MQTTPublishStatus st = tryPublish(topic, payload, length, retain, qos);
+    return st == MQTT_PUB_OK || st == MQTT_PUB_QUEUED;
+  }
+
+  // Allocation-free: fixed header, topic and payload are written straight
+  // into _txBuf, which is then handed to sendBIN() as-is. If earlier
+  // packets are still queued (or the socket stalled this loop) the packet
+  // is appended to the outbound queue instead; once that queue is above
+  // the high watermark the caller gets MQTT_PUB_WOULD_BLOCK.
+  MQTTPublishStatus tryPublish(const char* topic, const uint8_t* payload, size_t length,
+                               bool retain = false, uint8_t qos = 0) {
+    return tryPublishWith(topic, length, [&](uint8_t* dst) {
+      memcpy(dst, payload, length);
+      return length;
+    }, retain, qos);
+  }
+
+  // Largest payload a PUBLISH to `topic` fits into _txBuf with, assuming
+  // the full topic and every MQTT 5 property (callers size batches by it)
+  size_t maxPayload(const char* topic, uint8_t qos = 0) const {
+    size_t overhead = 1 + 4 + 2 + strlen(topic) + (qos == 1 ? 2 : 0);
+    if (_mqtt5) {
+      uint32_t propsLen = 3 + (_messageExpiry ? 5 : 0);
+      for (auto& up : _userProps) propsLen += 5 + up.first.length() + up.second.length();
+      overhead += _varIntSize(propsLen) + propsLen;
+    }
+    return overhead < MQTT_WS_TX_BUFFER_SIZE ? MQTT_WS_TX_BUFFER_SIZE - overhead : 0;
+  }
+
+  // Same as tryPublish(), but `write(uint8_t* dst)` puts exactly `length`
+  // payload bytes straight into the frame buffer and returns how many it
+  // wrote, e.g. serializeJson(doc, dst, length) after measureJson(doc).
+  // It is not called when the packet is refused up front.
+  template <typename Writer>
+  MQTTPublishStatus tryPublishWith(const char* topic, size_t length, Writer&& write,
+                                   bool retain = false, uint8_t qos = 0) {
+    if (!_connected) return MQTT_PUB_NOT_CONNECTED;
+
+    if (_txQueue.bytes() >= _highWater) {
+      _blocked = true;
+      _stats.wouldBlock++;
+      return MQTT_PUB_WOULD_BLOCK;
+    }
 
+    InFlight* slot = nullptr;
     if (qos == 1) {
-      uint16_t pid = _nextPacketId++;
-      body.push_back(pid >> 8);
-      body.push_back(pid & 0xFF);
+      slot = _freeSlot();
+      if (!slot) {
+        MQTTLOG("PUBLISH → %s refused — %d QoS1 messages in flight", topic, _inflightCount);
+        _blocked = true;
+        _stats.wouldBlock++;
+        return MQTT_PUB_WOULD_BLOCK;
+      }
     }
 
-    for (char c : payload) body.push_back((uint8_t)c);
+    size_t topicLen = strlen(topic);
+
+    // MQTT 5: QoS 0 topics are replaced by an alias once the broker has
+    // seen them. QoS 1 keeps the full topic so a retransmit after
+    // reconnect (when aliases are reset) is still valid.
+    uint16_t alias     = 0;
+    bool     aliasOnly = false;
+    uint32_t propsLen  = 0;
+    if (_mqtt5) {
+      if (qos == 0) alias = _topicAlias(topic, aliasOnly);
+      if (alias)          propsLen += 3;
+      if (_messageExpiry) propsLen += 5;
+      for (auto& up : _userProps) propsLen += 5 + up.first.length() + up.second.length();
+    }
+    size_t   wireTopic = aliasOnly ? 0 : topicLen;
+    uint32_t remLen    = 2 + wireTopic + (qos == 1 ? 2 : 0) + length;
+    if (_mqtt5) remLen += _varIntSize(propsLen) + propsLen;
+    size_t   pktLen    = 1 + _varIntSize(remLen) + remLen;
+    if (pktLen > MQTT_WS_TX_BUFFER_SIZE) {
+      MQTTLOG("PUBLISH → %s too large (%d > %d bytes)",
+              topic, pktLen, MQTT_WS_TX_BUFFER_SIZE);
+      return MQTT_PUB_TOO_LARGE;
+    }
 
     uint8_t fixedHeader = MQTT_PUBLISH;
     if (retain)   fixedHeader |= 0x01;
     if (qos == 1) fixedHeader |= MQTT_QOS1;
 
-    std::vector<uint8_t> pkt;
-    pkt.push_back(fixedHeader);
-    _appendVarInt(pkt, body.size());
-    pkt.insert(pkt.end(), body.begin(), body.end());
+    uint8_t* pkt = _txBuf + WEBSOCKETS_MAX_HEADER_SIZE;
+    uint8_t* p   = pkt;
+    *p++ = fixedHeader;
+    p    = _writeVarInt(p, remLen);
+    *p++ = wireTopic >> 8;
+    *p++ = wireTopic & 0xFF;
+    memcpy(p, topic, wireTopic);
+    p += wireTopic;
+
+    uint16_t pid = 0;
+    if (qos == 1) {
+      pid  = _allocPacketId();
+      *p++ = pid >> 8;
+      *p++ = pid & 0xFF;
+    }
 
-    MQTTLOG("PUBLISH → %s (%d bytes)", topic.c_str(), pkt.size());
-    return _wsSend(pkt);
+    if (_mqtt5) {
+      p = _writeVarInt(p, propsLen);
+      if (alias) {
+        *p++ = MQTT_PROP_TOPIC_ALIAS;
+        p    = _writeU16(p, alias);
+      }
+      if (_messageExpiry) {
+        *p++ = MQTT_PROP_MESSAGE_EXPIRY;
+        p    = _writeU32(p, _messageExpiry);
+      }
+      for (auto& up : _userProps) {
+        *p++ = MQTT_PROP_USER_PROPERTY;
+        p    = _writeStr(p, up.first);
+        p    = _writeStr(p, up.second);
+      }
+    }
+
+    if (length && write(p) != length) {
+      MQTTLOG("PUBLISH → %s payload writer came up short", topic);
+      return MQTT_PUB_FAILED;
+    }
+
+    // Packet goes behind anything already queued
+    bool queue = !_txQueue.empty() || _saturated;
+    if (queue && !_txQueue.push(pkt, pktLen)) {
+      _blocked = true;
+      _stats.wouldBlock++;
+      return MQTT_PUB_WOULD_BLOCK;
+    }
+
+    MQTTLOG("PUBLISH → %s (%d bytes%s%s)", topic, pktLen,
+            aliasOnly ? ", aliased" : "", queue ? ", queued" : "");
+
+    if (slot) {
+      // Keep an unmasked copy for retransmission before sendBIN consumes _txBuf.
+      // A queued packet's retry timer restarts when _flushTx() sends it.
+      slot->pkt.assign(pkt, pkt + pktLen);
+      slot->pid     = pid;
+      slot->retries = 0;
+      slot->sent    = false;
+      slot->sentAt  = millis();
+      _inflightCount++;
+      _lastPacketId = pid;
+      _stats.sent++;
+    }
+
+    // The broker learns an alias from the packet that carries the full
+    // topic, so it only counts once that packet is queued or sent
+    if (queue) {
+      if (alias && !aliasOnly) _aliasTopics.push_back(topic);
+      return MQTT_PUB_QUEUED;
+    }
+
+    // A QoS 1 packet stays in the window even if the send fails; it is
+    // retried later
+    bool ok = _wsSendTx(pktLen);
+    if (ok && slot) slot->sent = true;
+    if (ok && alias && !aliasOnly) _aliasTopics.push_back(topic);
+    return (ok || slot) ? MQTT_PUB_OK : MQTT_PUB_FAILED;
+  }
+
+  // ─── Backpressure ─────────────────────────
+  // High/low watermarks are byte counts of the outbound queue. After a
+  // MQTT_PUB_WOULD_BLOCK, onWritable fires once it drains below `low`
+  // and the QoS 1 window has a free slot.
+  void setWatermarks(size_t high, size_t low) {
+    _highWater = high;
+    _lowWater  = low < high ? low : high;
   }
+  void   onWritable(MQTTWritableCallback cb) { _writableCb = cb; }
+  bool   writable() const {
+    return _connected && _txQueue.bytes() < _highWater && _inflightCount < _maxInflight;
+  }
+  size_t queuedBytes() const                 { return _txQueue.bytes(); }
+
+  // ─── Event-driven callers ─────────────────
+  // Socket to wait on (select()) between loop() calls, or -1 while the
+  // TCP side is down. Only valid until the next loop() call, which may
+  // close it. Under TLS, check hasBufferedInput() first: mbedTLS may
+  // already hold decrypted bytes the socket no longer shows as readable.
+  int  socketFd()             { return _ws.tcpConnected() ? _ws.fd() : -1; }
+  // loop() has work to do right away (deferred CONNECT, queued packets)
+  bool hasPendingWork() const { return _pendingConnect || (_connected && !_txQueue.empty()); }
+  // Received bytes wait in the client's buffer, where select() on
+  // socketFd() no longer sees them
+  bool hasBufferedInput()     { return _ws.tcpConnected() && _ws.available() > 0; }
 
   // ─── Subscribe ────────────────────────────
+  // Filters are stored and all of them go out in one SUBSCRIBE after each
+  // CONNACK. Subscribing again to a stored filter with the same QoS is a
+  // no-op, so callers can re-subscribe on every connect for free.
   bool subscribe(const String& topic, uint8_t qos = 0) {
+    auto it = _subscriptions.find(topic);
+    if (it != _subscriptions.end() && it->second == qos) return _connected;
     _subscriptions[topic] = qos;        // always store for re-sub on reconnect
+    _subsConfirmed        = false;
     if (!_connected) return false;
-    return _sendSubscribe(topic, qos);
+    return _sendSubscribe(topic);
   }
 
   bool connected() { return _connected; }
@@ -148,7 +504,7 @@ public:
   }
 
 private:
-  WebSocketsClient _ws;
+  MQTTWSClient _ws;
   const char* _host      = nullptr;
   uint16_t    _port      = 443;
   const char* _path      = "/mqtt";
@@ -162,27 +518,95 @@ private:
   bool     _connected      = false;
   bool     _wsReady        = false;
   bool     _pendingConnect = false;
+  bool     _cleanSession   = true;
+  bool     _sessionPresent = false;
+  bool     _subsConfirmed  = false;   // broker granted every stored filter this boot
+  bool     _subsRefused    = false;   // a SUBACK since the last full SUBSCRIBE refused one
+  uint32_t _sessionExpiry  = 3600;
   uint32_t _lastPing       = 0;
   uint16_t _nextPacketId   = 1;
+  uint16_t _lastPacketId   = 0;
 
   MQTTMessageCallback    _msgCb;
+  MQTTRawMessageCallback _rawCb;
   MQTTConnectCallback    _conCb;
   MQTTDisconnectCallback _disCb;
+  MQTTPublishCallback    _pubCb;
+  MQTTSubscribeCallback  _subCb;
+  MQTTWritableCallback   _writableCb;
 
   std::map<String, uint8_t> _subscriptions;
+  std::map<uint16_t, std::vector<String>> _pendingSubs;   // SUBSCRIBE pid → filters, in order
+
+  uint8_t _txBuf[WEBSOCKETS_MAX_HEADER_SIZE + MQTT_WS_TX_BUFFER_SIZE];
+
+  // ── Outbound queue ────────────────────────
+  RecordRing _txQueue{MQTT_WS_TX_QUEUE_SIZE};
+  size_t     _highWater = MQTT_WS_TX_QUEUE_SIZE * 3 / 4;
+  size_t     _lowWater  = MQTT_WS_TX_QUEUE_SIZE / 4;
+  bool       _blocked   = false;   // a caller saw WOULD_BLOCK
+  bool       _saturated = false;   // a send stalled during this loop()
+
+  // ── MQTT 5 state ──────────────────────────
+  bool                                   _mqtt5         = false;
+  uint32_t                               _messageExpiry = 0;
+  std::vector<std::pair<String, String>> _userProps;
+  uint16_t                               _aliasMax      = 0;   // from CONNACK
+  std::vector<String>                    _aliasTopics;        // alias = index + 1
+
+  // ── QoS 1 in-flight table ─────────────────
+  struct InFlight {
+    uint16_t             pid     = 0;   // 0 = free slot
+    uint8_t              retries = 0;
+    bool                 sent    = false;   // reached the socket at least once
+    uint32_t             sentAt  = 0;
+    std::vector<uint8_t> pkt;           // capacity is reused between messages
+  };
+  enum InflightOutcome : uint8_t { INFLIGHT_ACKED, INFLIGHT_REJECTED, INFLIGHT_EXPIRED };
+  InFlight         _inflight[MQTT_WS_MAX_INFLIGHT];
+  uint8_t          _maxInflight   = MQTT_WS_MAX_INFLIGHT;   // may be lowered by the broker
+  uint8_t          _inflightLimit = MQTT_WS_MAX_INFLIGHT;   // as configured
+  uint8_t          _inflightCount = 0;
+  MQTTPublishStats _stats;
+
+  // ── Reconnect state ───────────────────────
+  MQTTConnectionStats _connStats;
+  uint32_t            _reconnectDelay = MQTT_WS_RECONNECT_MIN_MS;
+  uint32_t            _attemptAt      = 0;   // start of the last connect attempt
+  uint32_t            _connectSentAt  = 0;
+  uint32_t            _lostAt         = 0;   // 0 = not recovering
+  uint32_t            _lowHeap        = UINT32_MAX;
+
+  // ── Stream decoder state ──────────────────
+  enum RxState : uint8_t { RX_HEADER, RX_LENGTH, RX_BODY, RX_DISCARD };
+  RxState  _rxState  = RX_HEADER;
+  uint8_t  _rxHeader = 0;
+  uint8_t  _rxShift  = 0;
+  uint32_t _rxRemLen = 0;
+  uint32_t _rxPos    = 0;
+  uint8_t  _rxBuf[MQTT_WS_RX_BUFFER_SIZE];
 
   // ─── WebSocket events ─────────────────────
   void _onWsEvent(WStype_t type, uint8_t* payload, size_t length) {
     switch (type) {
 
       case WStype_CONNECTED:
-        MQTTLOG("WebSocket connected — deferring MQTT CONNECT by one loop()");
+        if (_attemptAt) _connStats.handshakeMs = millis() - _attemptAt;
+        MQTTLOG("WebSocket connected in %lu ms — deferring MQTT CONNECT by one loop()",
+                (unsigned long)_connStats.handshakeMs);
+        _rxReset();
         _wsReady        = true;
         _pendingConnect = true;
         break;
 
       case WStype_DISCONNECTED:
         MQTTLOG("WebSocket disconnected");
+        if (_connected || !_lostAt) {
+          _lostAt  = millis();
+          _lowHeap = UINT32_MAX;
+        }
+        _rxReset();
+        _dropTxQueue();
         _wsReady        = false;
         _connected      = false;
         _pendingConnect = false;
@@ -191,14 +615,24 @@ private:
 
       // FIX 4: Accept MQTT data on both BIN and TEXT frames
       // Cloudflare may forward CONNACK as a text frame
+      // Frames are a byte stream: one packet may span several frames (or WS
+      // fragments) and one frame may carry several packets.
       case WStype_BIN:
         MQTTLOG("← BIN %d bytes  [0]=0x%02X", length, length ? payload[0] : 0);
-        _handlePacket(payload, length);
+        _rxFeed(payload, length);
         break;
 
       case WStype_TEXT:
         MQTTLOG("← TEXT %d bytes [0]=0x%02X", length, length ? payload[0] : 0);
-        _handlePacket(payload, length);
+        _rxFeed(payload, length);
+        break;
+
+      case WStype_FRAGMENT_BIN_START:
+      case WStype_FRAGMENT_TEXT_START:
+      case WStype_FRAGMENT:
+      case WStype_FRAGMENT_FIN:
+        MQTTLOG("← FRAGMENT %d bytes", length);
+        _rxFeed(payload, length);
         break;
 
       case WStype_ERROR:
@@ -218,16 +652,60 @@ private:
     }
   }
 
+  // ─── Reconnect ────────────────────────────
+  // WebSocketsClient::loop() tries a TCP connect once the reconnect
+  // interval has passed; the attempt either connects or stamps the
+  // failure time, however quickly it failed.
+  void _loopConnecting() {
+    bool          wasDown = !_ws.tcpConnected();
+    unsigned long failAt  = _ws.lastConnectFail();
+    uint32_t      start   = millis();
+    _ws.loop();
+    if (wasDown && (_ws.tcpConnected() || _ws.lastConnectFail() != failAt)) {
+      _attemptAt = start;
+      _connStats.attempts++;
+      _reconnectDelay = _reconnectDelay >= MQTT_WS_RECONNECT_MAX_MS / 2
+                      ? MQTT_WS_RECONNECT_MAX_MS : _reconnectDelay * 2;
+      _ws.setReconnectInterval(_jittered(_reconnectDelay));
+    }
+    if (_lostAt) {
+      uint32_t heap = ESP.getFreeHeap();
+      if (heap < _lowHeap) _lowHeap = heap;
+    }
+  }
+
+  void _onConnected() {
+    uint32_t now = millis();
+    _connStats.connects++;
+    _connStats.connackMs = now - _connectSentAt;
+    if (_lostAt) {
+      _connStats.recoveryMs   = now - _lostAt;
+      _connStats.recoveryHeap = _lowHeap;
+      _lostAt = 0;
+      MQTTLOG("Recovered in %lu ms (handshake %lu ms, CONNACK %lu ms, low heap %lu)",
+              (unsigned long)_connStats.recoveryMs, (unsigned long)_connStats.handshakeMs,
+              (unsigned long)_connStats.connackMs, (unsigned long)_connStats.recoveryHeap);
+    }
+    _reconnectDelay = MQTT_WS_RECONNECT_MIN_MS;
+    _ws.setReconnectInterval(_jittered(_reconnectDelay));
+  }
+
+  static uint32_t _jittered(uint32_t ms) {
+    uint32_t spread = ms * MQTT_WS_RECONNECT_JITTER / 100;
+    return spread ? ms - spread + random(2 * spread + 1) : ms;
+  }
+
   // ─── MQTT CONNECT ─────────────────────────
   void _sendConnect() {
+    _connectSentAt = millis();
     MQTTLOG("Sending CONNECT  clientId=%s user=%s",
             _clientId.c_str(), _user.length() ? _user.c_str() : "(none)");
 
     std::vector<uint8_t> body;
     _appendString(body, "MQTT");    // protocol name
-    body.push_back(0x04);           // protocol level 3.1.1
+    body.push_back(_mqtt5 ? 0x05 : 0x04);  // protocol level 5.0 / 3.1.1
 
-    uint8_t flags = 0x02;           // clean session
+    uint8_t flags = _cleanSession ? 0x02 : 0x00;   // clean session / clean start
     if (_user.length()) flags |= 0x80;
     if (_pass.length()) flags |= 0x40;
     body.push_back(flags);
@@ -235,6 +713,20 @@ private:
     body.push_back(_keepAlive >> 8);
     body.push_back(_keepAlive & 0xFF);
 
+    if (_mqtt5) {
+      // v5 sessions end at disconnect unless Session Expiry Interval > 0
+      if (!_cleanSession && _sessionExpiry) {
+        body.push_back(5);
+        body.push_back(MQTT_PROP_SESSION_EXPIRY);
+        body.push_back(_sessionExpiry >> 24);
+        body.push_back((_sessionExpiry >> 16) & 0xFF);
+        body.push_back((_sessionExpiry >> 8) & 0xFF);
+        body.push_back(_sessionExpiry & 0xFF);
+      } else {
+        body.push_back(0x00);           // no CONNECT properties
+      }
+    }
+
     _appendString(body, _clientId);
     if (_user.length()) _appendString(body, _user);
     if (_pass.length()) _appendString(body, _pass);
@@ -252,43 +744,210 @@ private:
   }
 
   // ─── MQTT SUBSCRIBE ───────────────────────
-  bool _sendSubscribe(const String& topic, uint8_t qos) {
-    std::vector<uint8_t> body;
-    uint16_t pid = _nextPacketId++;
-    body.push_back(pid >> 8);
-    body.push_back(pid & 0xFF);
-    _appendString(body, topic);
-    body.push_back(qos);
+  typedef std::map<String, uint8_t>::const_iterator SubIter;
+
+  // The stored entry carries the requested QoS into the options byte
+  bool _sendSubscribe(const String& topic) {
+    SubIter it = _subscriptions.find(topic);
+    if (it == _subscriptions.end()) return false;
+    SubIter last = it;
+    return _sendSubscribeBatch(it, ++last);
+  }
 
-    std::vector<uint8_t> pkt;
-    pkt.push_back(MQTT_SUBSCRIBE);
-    _appendVarInt(pkt, body.size());
-    pkt.insert(pkt.end(), body.begin(), body.end());
+  // Every stored filter, packed into as few SUBSCRIBE packets as _txBuf
+  // allows (normally one).
+  void _sendSubscribeAll() {
+    _pendingSubs.clear();
+    _subsRefused = false;
+    SubIter it = _subscriptions.begin();
+    while (it != _subscriptions.end()) {
+      SubIter first = it;
+      size_t  body  = 2 + (_mqtt5 ? 1 : 0);
+      while (it != _subscriptions.end()) {
+        size_t entry = 2 + it->first.length() + 1;
+        if (5 + body + entry > MQTT_WS_TX_BUFFER_SIZE) break;
+        body += entry;
+        ++it;
+      }
+      if (it == first) {
+        MQTTLOG("SUBSCRIBE → %s too large — skipped", it->first.c_str());
+        ++it;
+        continue;
+      }
+      _sendSubscribeBatch(first, it);
+    }
+  }
 
-    MQTTLOG("SUBSCRIBE → %s QoS%d pid=%d", topic.c_str(), qos, pid);
-    return _wsSend(pkt);
+  bool _sendSubscribeBatch(SubIter first, SubIter last) {
+    uint16_t pid  = _allocPacketId();
+    size_t   body = 2 + (_mqtt5 ? 1 : 0);
+    for (SubIter i = first; i != last; ++i) body += 2 + i->first.length() + 1;
+    if (5 + body > MQTT_WS_TX_BUFFER_SIZE) {
+      MQTTLOG("SUBSCRIBE too large (%d bytes)", body);
+      return false;
+    }
+
+    uint8_t* start = _txBuf + WEBSOCKETS_MAX_HEADER_SIZE;
+    uint8_t* p     = start;
+    *p++ = MQTT_SUBSCRIBE;
+    p    = _writeVarInt(p, body);
+    p    = _writeU16(p, pid);
+    if (_mqtt5) *p++ = 0x00;            // no SUBSCRIBE properties
+
+    std::vector<String>& filters = _pendingSubs[pid];
+    filters.clear();
+    for (SubIter i = first; i != last; ++i) {
+      p    = _writeStr(p, i->first);
+      *p++ = i->second;
+      filters.push_back(i->first);
+    }
+
+    MQTTLOG("SUBSCRIBE → %d filter(s) pid=%d", filters.size(), pid);
+    return _wsSendTx(p - start);
   }
 
-  // ─── Incoming packet parser ───────────────
-  void _handlePacket(uint8_t* data, size_t len) {
-    if (len < 2) {
-      MQTTLOG("Frame too short (%d bytes)", len);
-      return;
+  // ─── Incoming stream decoder ──────────────
+  void _rxReset() {
+    _rxState  = RX_HEADER;
+    _rxRemLen = 0;
+    _rxShift  = 0;
+    _rxPos    = 0;
+  }
+
+  // Decode a remaining-length varint that is fully present in [p, p+avail).
+  // Returns false if it is incomplete or malformed.
+  static bool _peekVarInt(const uint8_t* p, size_t avail,
+                          uint32_t& val, size_t& used) {
+    val = 0;
+    for (size_t i = 0; i < 4 && i < avail; i++) {
+      val |= (uint32_t)(p[i] & 0x7F) << (7 * i);
+      if (!(p[i] & 0x80)) { used = i + 1; return true; }
     }
+    return false;
+  }
+
+  void _rxFeed(uint8_t* data, size_t len) {
+    size_t i = 0;
+    while (i < len) {
+      switch (_rxState) {
+
+        case RX_HEADER: {
+          // Fast path: the whole packet is inside this frame → no copy
+          uint32_t remLen;
+          size_t   used;
+          if (_peekVarInt(data + i + 1, len - i - 1, remLen, used) &&
+              len - i - 1 - used >= remLen) {
+            uint8_t header = data[i];
+            i += 1 + used;
+            _handlePacket(header, data + i, remLen);
+            i += remLen;
+            break;
+          }
+          _rxHeader = data[i++];
+          _rxRemLen = 0;
+          _rxShift  = 0;
+          _rxState  = RX_LENGTH;
+          break;
+        }
 
-    uint8_t pktType = data[0] & 0xF0;
+        case RX_LENGTH: {
+          uint8_t b = data[i++];
+          _rxRemLen |= (uint32_t)(b & 0x7F) << _rxShift;
+          _rxShift  += 7;
+          if (b & 0x80) {
+            if (_rxShift >= 28) {
+              MQTTLOG("Malformed remaining length — dropping connection");
+              _rxReset();
+              _ws.disconnect();
+              return;
+            }
+            break;
+          }
+          _rxPos = 0;
+          if (_rxRemLen == 0) {
+            _rxState = RX_HEADER;
+            _handlePacket(_rxHeader, _rxBuf, 0);
+          } else if (_rxRemLen > MQTT_WS_RX_BUFFER_SIZE) {
+            MQTTLOG("Packet type=0x%02X too large (%u bytes) — skipping",
+                    _rxHeader, _rxRemLen);
+            _rxState = RX_DISCARD;
+          } else {
+            _rxState = RX_BODY;
+          }
+          break;
+        }
+
+        case RX_BODY: {
+          size_t n = _rxRemLen - _rxPos;
+          if (n > len - i) n = len - i;
+          memcpy(_rxBuf + _rxPos, data + i, n);
+          _rxPos += n;
+          i      += n;
+          if (_rxPos == _rxRemLen) {
+            _rxState = RX_HEADER;
+            _handlePacket(_rxHeader, _rxBuf, _rxRemLen);
+          }
+          break;
+        }
+
+        case RX_DISCARD: {
+          size_t n = _rxRemLen - _rxPos;
+          if (n > len - i) n = len - i;
+          _rxPos += n;
+          i      += n;
+          if (_rxPos == _rxRemLen) _rxState = RX_HEADER;
+          break;
+        }
+      }
+    }
+  }
+
+  // ─── Incoming packet parser ───────────────
+  // `data` is the variable header + payload of one complete packet.
+  void _handlePacket(uint8_t header, uint8_t* data, size_t len) {
+    uint8_t pktType = header & 0xF0;
 
     switch (pktType) {
 
       // ── CONNACK ─────────────────────────
       case MQTT_CONNACK: {
-        if (len < 4) { MQTTLOG("CONNACK truncated"); return; }
-        uint8_t rc = data[3];
+        if (len < 2) { MQTTLOG("CONNACK truncated"); return; }
+        uint8_t rc = data[1];
+        if (_mqtt5) {
+          if (rc != 0x00) {
+            MQTTLOG("❌ CONNACK refused 0x%02X: %s", rc, _reasonString(rc));
+            return;
+          }
+          _aliasMax    = 0;
+          _maxInflight = _inflightLimit;
+          _aliasTopics.clear();
+          _parseProperties(data + 2, len - 2,
+                           [this](uint8_t id, const uint8_t* v, size_t) {
+            if (id == MQTT_PROP_TOPIC_ALIAS_MAX) {
+              uint16_t n = ((uint16_t)v[0] << 8) | v[1];
+              _aliasMax = n < MQTT_WS_MAX_TOPIC_ALIASES ? n : MQTT_WS_MAX_TOPIC_ALIASES;
+            } else if (id == MQTT_PROP_RECEIVE_MAXIMUM) {
+              uint16_t n = ((uint16_t)v[0] << 8) | v[1];
+              if (n < _maxInflight) _maxInflight = n ? n : 1;
+            }
+          });
+          MQTTLOG("CONNACK v5: topic aliases=%d, in-flight window=%d", _aliasMax, _maxInflight);
+        }
         if (rc == 0x00) {
+          _onConnected();
           MQTTLOG("✅ CONNACK OK");
           _connected = true;
           _lastPing  = millis();
-          for (auto& sub : _subscriptions) _sendSubscribe(sub.first, sub.second);
+          // Resumed session: the broker still holds every filter it granted
+          // earlier in this boot, so skip the SUBSCRIBE round trip. After
+          // a reboot we can't know that, so we always send it once.
+          _sessionPresent = !_cleanSession && (data[0] & 0x01);
+          if (_sessionPresent && _subsConfirmed) {
+            MQTTLOG("Session resumed — skipping re-subscribe");
+          } else {
+            _sendSubscribeAll();
+          }
+          if (_inflightCount) _retryInflight(true);
           if (_conCb) _conCb();
         } else {
           const char* reasons[] = {
@@ -302,23 +961,15 @@ private:
 
       // ── PUBLISH ─────────────────────────
       case MQTT_PUBLISH: {
-        uint8_t qos = (data[0] & 0x06) >> 1;
-        size_t  pos = 1;
-
-        // Remaining length varint
-        uint32_t remLen = 0, shift = 0;
-        do {
-          if (pos >= len) return;
-          remLen |= (uint32_t)(data[pos] & 0x7F) << shift;
-          shift  += 7;
-        } while (data[pos++] & 0x80);
+        uint8_t qos = (header & 0x06) >> 1;
+        size_t  pos = 0;
 
         // Topic string
         if (pos + 2 > len) return;
         uint16_t topicLen = ((uint16_t)data[pos] << 8) | data[pos + 1];
         pos += 2;
         if (pos + topicLen > len) return;
-        String topic((char*)(data + pos), topicLen);
+        const char* topic = (const char*)(data + pos);
         pos += topicLen;
 
         // Packet ID (QoS 1)
@@ -329,19 +980,72 @@ private:
           _sendPubAck(pid);
         }
 
+        // MQTT 5 properties (we advertise no inbound aliases, so skip them)
+        if (_mqtt5) {
+          uint32_t propsLen;
+          size_t   used;
+          if (!_peekVarInt(data + pos, len - pos, propsLen, used)) return;
+          pos += used;
+          if (pos + propsLen > len) return;
+          pos += propsLen;
+        }
+
         // Payload
-        String payload((char*)(data + pos), len > pos ? len - pos : 0);
-        MQTTLOG("PUBLISH ← [%s] %s", topic.c_str(), payload.c_str());
-        if (_msgCb) _msgCb(topic, payload);
+        MQTTLOG("PUBLISH ← [%.*s] %.*s", topicLen, topic, (int)(len - pos), (const char*)(data + pos));
+        if (_rawCb) _rawCb(topic, topicLen, data + pos, len - pos);
+        if (_msgCb) _msgCb(String(topic, topicLen), String((const char*)(data + pos), len - pos));
         break;
       }
 
-      case MQTT_PUBACK:
-        MQTTLOG("PUBACK ←");
+      case MQTT_PUBACK: {
+        if (len < 2) { MQTTLOG("PUBACK truncated"); return; }
+        uint16_t pid = ((uint16_t)data[0] << 8) | data[1];
+        uint8_t  rc  = (_mqtt5 && len > 2) ? data[2] : 0x00;
+        if (rc >= 0x80) {
+          MQTTLOG("PUBACK ← pid=%d rejected 0x%02X: %s", pid, rc, _reasonString(rc));
+          _completeInflight(pid, INFLIGHT_REJECTED);
+        } else {
+          MQTTLOG("PUBACK ← pid=%d", pid);
+          _completeInflight(pid, INFLIGHT_ACKED);
+        }
+        break;
+      }
+
+      case MQTT_SUBACK: {
+        if (len < 2) { MQTTLOG("SUBACK truncated"); return; }
+        uint16_t pid = ((uint16_t)data[0] << 8) | data[1];
+        size_t   pos = 2;
+        if (_mqtt5) {
+          uint32_t propsLen;
+          size_t   used;
+          if (!_peekVarInt(data + pos, len - pos, propsLen, used)) return;
+          pos += used + propsLen;
+        }
+
+        // Return codes are in the same order as the filters we sent
+        auto it = _pendingSubs.find(pid);
+        for (size_t i = 0; pos < len; pos++, i++) {
+          uint8_t       rc     = data[pos];
+          const String* filter = (it != _pendingSubs.end() && i < it->second.size())
+                                     ? &it->second[i] : nullptr;
+          const char*   name   = filter ? filter->c_str() : "?";
+          if (rc >= 0x80) {
+            MQTTLOG("❌ SUBACK ← %s refused 0x%02X: %s", name, rc, _reasonString(rc));
+            _subsRefused = true;
+          } else
+            MQTTLOG("✅ SUBACK ← %s QoS granted=%d", name, rc);
+          if (filter && _subCb) _subCb(*filter, rc);
+        }
+        if (it != _pendingSubs.end()) _pendingSubs.erase(it);
+        // A refused filter is not in the broker's session: keep sending the
+        // full SUBSCRIBE on every connect until all of them are granted
+        if (_pendingSubs.empty()) _subsConfirmed = !_subsRefused;
         break;
+      }
 
-      case MQTT_SUBACK:
-        MQTTLOG("✅ SUBACK ← QoS granted=0x%02X", len > 2 ? data[len - 1] : 0xFF);
+      case MQTT_DISCONNECT:
+        // MQTT 5 only: broker-initiated DISCONNECT with a reason code
+        MQTTLOG("DISCONNECT ← 0x%02X: %s", len ? data[0] : 0, _reasonString(len ? data[0] : 0));
         break;
 
       case MQTT_PINGRESP:
@@ -350,20 +1054,202 @@ private:
         break;
 
       default:
-        MQTTLOG("Unknown type=0x%02X len=%d — hex dump:", data[0], len);
+        MQTTLOG("Unknown type=0x%02X len=%d — hex dump:", header, len);
         for (size_t i = 0; i < len && i < 16; i++) Serial.printf("%02X ", data[i]);
         Serial.println();
         break;
     }
   }
 
+  // ─── MQTT 5 helpers ───────────────────────
+  // Returns the alias for `topic` (0 = none). `aliasOnly` is set when the
+  // broker already knows the mapping and the topic can be sent empty.
+  uint16_t _topicAlias(const char* topic, bool& aliasOnly) {
+    aliasOnly = false;
+    for (size_t i = 0; i < _aliasTopics.size(); i++) {
+      if (strcmp(_aliasTopics[i].c_str(), topic) == 0) {
+        aliasOnly = true;
+        return i + 1;
+      }
+    }
+    // New alias; the caller records it once the packet is actually sent
+    if (_aliasTopics.size() >= _aliasMax) return 0;
+    return _aliasTopics.size() + 1;
+  }
+
+  // Walks an MQTT 5 property block (varint length + properties) and calls
+  // fn(id, value, valueLen) for each. Unknown ids stop the walk.
+  template <typename F>
+  static void _parseProperties(const uint8_t* data, size_t len, F&& fn) {
+    uint32_t total;
+    size_t   used;
+    if (!_peekVarInt(data, len, total, used) || used + total > len) return;
+    const uint8_t* p   = data + used;
+    const uint8_t* end = p + total;
+    while (p < end) {
+      uint8_t id = *p++;
+      size_t  n;
+      switch (id) {
+        case 0x01: case 0x17: case 0x19: case 0x24: case 0x25:
+        case 0x28: case 0x29: case 0x2A:
+          n = 1; break;
+        case 0x13: case 0x21: case 0x22: case 0x23:
+          n = 2; break;
+        case 0x02: case 0x11: case 0x18: case 0x27:
+          n = 4; break;
+        case 0x0B: {
+          uint32_t v;
+          if (!_peekVarInt(p, end - p, v, n)) return;
+          break;
+        }
+        case 0x03: case 0x08: case 0x09: case 0x12: case 0x15:
+        case 0x16: case 0x1A: case 0x1C: case 0x1F:
+          if (end - p < 2) return;
+          n = 2 + (((size_t)p[0] << 8) | p[1]);
+          break;
+        case 0x26: {
+          if (end - p < 2) return;
+          size_t k = 2 + (((size_t)p[0] << 8) | p[1]);
+          if ((size_t)(end - p) < k + 2) return;
+          n = k + 2 + (((size_t)p[k] << 8) | p[k + 1]);
+          break;
+        }
+        default:
+          MQTTLOG("Unknown MQTT 5 property 0x%02X", id);
+          return;
+      }
+      if ((size_t)(end - p) < n) return;
+      fn(id, p, n);
+      p += n;
+    }
+  }
+
+  static const char* _reasonString(uint8_t rc) {
+    switch (rc) {
+      case 0x00: return "Success";
+      case 0x10: return "No matching subscribers";
+      case 0x80: return "Unspecified error";
+      case 0x81: return "Malformed packet";
+      case 0x82: return "Protocol error";
+      case 0x83: return "Implementation specific error";
+      case 0x84: return "Unsupported protocol version";
+      case 0x85: return "Client ID not valid";
+      case 0x86: return "Bad user name or password";
+      case 0x87: return "Not authorized";
+      case 0x88: return "Server unavailable";
+      case 0x89: return "Server busy";
+      case 0x8A: return "Banned";
+      case 0x8E: return "Session taken over";
+      case 0x8F: return "Topic filter invalid";
+      case 0x90: return "Topic name invalid";
+      case 0x91: return "Packet ID in use";
+      case 0x94: return "Topic alias invalid";
+      case 0x95: return "Packet too large";
+      case 0x97: return "Quota exceeded";
+      case 0x99: return "Payload format invalid";
+      case 0x9A: return "Retain not supported";
+      case 0x9B: return "QoS not supported";
+      case 0x9E: return "Shared subscriptions not supported";
+      case 0xA1: return "Subscription IDs not supported";
+      case 0xA2: return "Wildcard subscriptions not supported";
+      default:   return "Unknown";
+    }
+  }
+
+  static uint8_t* _writeU16(uint8_t* p, uint16_t v) {
+    *p++ = v >> 8;
+    *p++ = v & 0xFF;
+    return p;
+  }
+
+  static uint8_t* _writeU32(uint8_t* p, uint32_t v) {
+    *p++ = v >> 24;
+    *p++ = (v >> 16) & 0xFF;
+    *p++ = (v >> 8) & 0xFF;
+    *p++ = v & 0xFF;
+    return p;
+  }
+
+  static uint8_t* _writeStr(uint8_t* p, const String& str) {
+    p = _writeU16(p, str.length());
+    memcpy(p, str.c_str(), str.length());
+    return p + str.length();
+  }
+
+  // ─── QoS 1 in-flight window ───────────────
+  uint16_t _allocPacketId() {
+    for (;;) {
+      uint16_t pid = _nextPacketId++;
+      if (pid == 0) continue;
+      bool busy = false;
+      for (auto& f : _inflight) if (f.pid == pid) { busy = true; break; }
+      if (!busy) return pid;
+    }
+  }
+
+  InFlight* _freeSlot() {
+    if (_inflightCount >= _maxInflight) return nullptr;
+    for (auto& f : _inflight) if (f.pid == 0) return &f;
+    return nullptr;
+  }
+
+  // Each finished message is counted under exactly one outcome
+  void _completeInflight(uint16_t pid, InflightOutcome outcome) {
+    for (auto& f : _inflight) {
+      if (f.pid != pid) continue;
+      f.pid = 0;
+      _inflightCount--;
+      switch (outcome) {
+        case INFLIGHT_ACKED:    _stats.acked++;    break;
+        case INFLIGHT_REJECTED: _stats.rejected++; break;
+        case INFLIGHT_EXPIRED:  _stats.expired++;  break;
+      }
+      if (_pubCb) _pubCb(pid, outcome == INFLIGHT_ACKED);
+      _checkWritable();   // a slot is free again
+      return;
+    }
+  }
+
+  // Resend unacked packets: all of them right after a reconnect,
+  // otherwise only those older than MQTT_WS_RETRY_MS. Timed retries wait
+  // while the outbound queue holds packets: a retransmit must not
+  // overtake them, and one of them may be the original. DUP is only set
+  // on packets that reached the socket before; one that was still queued
+  // when the connection dropped goes out as a first delivery.
+  void _retryInflight(bool all) {
+    if (!all && !_txQueue.empty()) return;
+    uint32_t now = millis();
+    for (auto& f : _inflight) {
+      if (f.pid == 0) continue;
+      if (!all && now - f.sentAt < MQTT_WS_RETRY_MS) continue;
+      if (!all && f.retries >= MQTT_WS_MAX_RETRIES) {
+        MQTTLOG("QoS1 pid=%d not acked after %d retries — dropped", f.pid, f.retries);
+        _completeInflight(f.pid, INFLIGHT_EXPIRED);
+        continue;
+      }
+      f.retries++;
+      f.sentAt = now;
+      memcpy(_txBuf + WEBSOCKETS_MAX_HEADER_SIZE, f.pkt.data(), f.pkt.size());
+      if (f.sent) {
+        _stats.retransmits++;
+        MQTTLOG("PUBLISH ↻ pid=%d (retry %d)", f.pid, f.retries);
+        _txBuf[WEBSOCKETS_MAX_HEADER_SIZE] |= 0x08;   // DUP
+      } else {
+        MQTTLOG("PUBLISH → pid=%d (never sent, no DUP)", f.pid);
+      }
+      if (_wsSendTx(f.pkt.size())) f.sent = true;
+    }
+  }
+
   // ─── PUBACK ───────────────────────────────
+  // Encoded into _txBuf like a PUBLISH, so acking an inbound QoS 1
+  // message doesn't allocate
   void _sendPubAck(uint16_t pid) {
-    std::vector<uint8_t> pkt = {
-      MQTT_PUBACK, 0x02,
-      (uint8_t)(pid >> 8), (uint8_t)(pid & 0xFF)
-    };
-    _wsSend(pkt);
+    uint8_t* p = _txBuf + WEBSOCKETS_MAX_HEADER_SIZE;
+    p[0] = MQTT_PUBACK;
+    p[1] = 0x02;
+    _writeU16(p + 2, pid);
+    _wsSendTx(4);
   }
 
   // ─── PINGREQ ──────────────────────────────
@@ -391,6 +1277,92 @@ private:
     } while (val);
   }
 
+  static uint8_t _varIntSize(uint32_t val) {
+    uint8_t n = 1;
+    while (val >>= 7) n++;
+    return n;
+  }
+
+  static uint8_t* _writeVarInt(uint8_t* p, uint32_t val) {
+    do {
+      uint8_t b = val & 0x7F;
+      val >>= 7;
+      if (val) b |= 0x80;
+      *p++ = b;
+    } while (val);
+    return p;
+  }
+
+  // ─── Outbound queue ───────────────────────
+  void _flushTx() {
+    size_t budget = MQTT_WS_TX_BUDGET;
+    uint8_t* pkt;
+    size_t   len;
+    while (!_saturated && _txQueue.front(pkt, len)) {
+      if (len > budget) break;
+      // Copy out so a failed (masked) send leaves the queued packet intact
+      memcpy(_txBuf + WEBSOCKETS_MAX_HEADER_SIZE, pkt, len);
+      if (!_wsSendTx(len)) break;
+      _markSent(pkt, len);
+      _txQueue.pop();
+      budget -= len;
+    }
+
+    _checkWritable();
+  }
+
+  // A queued QoS 1 PUBLISH only starts its retry timer once it has
+  // actually been written to the socket
+  void _markSent(const uint8_t* pkt, size_t len) {
+    if ((pkt[0] & 0xF0) != MQTT_PUBLISH || (pkt[0] & 0x06) != MQTT_QOS1) return;
+    size_t pos = 1;
+    while (pos < len && (pkt[pos] & 0x80)) pos++;
+    pos++;
+    if (pos + 2 > len) return;
+    pos += 2 + (((size_t)pkt[pos] << 8) | pkt[pos + 1]);
+    if (pos + 2 > len) return;
+    uint16_t pid = ((uint16_t)pkt[pos] << 8) | pkt[pos + 1];
+    for (auto& f : _inflight) {
+      if (f.pid != pid) continue;
+      f.sent   = true;
+      f.sentAt = millis();
+    }
+  }
+
+  // Fires onWritable once after a WOULD_BLOCK, when both the outbound
+  // queue (low watermark) and the QoS 1 window have room again.
+  void _checkWritable() {
+    if (!_blocked || _txQueue.bytes() > _lowWater || _inflightCount >= _maxInflight) return;
+    _blocked = false;
+    MQTTLOG("Outbound queue drained — writable");
+    if (_writableCb) _writableCb();
+  }
+
+  // Queued QoS 0 packets belong to the old connection (and may use its
+  // topic aliases); QoS 1 ones are still in the in-flight window.
+  void _dropTxQueue() {
+    if (_txQueue.empty()) return;
+    MQTTLOG("Dropping %d queued packets", _txQueue.count());
+    _stats.txDropped += _txQueue.count();
+    _txQueue.clear();
+  }
+
+  // ─── Send packet from _txBuf ──────────────
+  // The packet starts at _txBuf + WEBSOCKETS_MAX_HEADER_SIZE. The WS
+  // library writes the frame header into the reserved bytes and masks the
+  // payload in place, so the buffer content is consumed by this call.
+  bool _wsSendTx(size_t len) {
+    if (!_wsReady) {
+      MQTTLOG("Send skipped — WS not ready");
+      return false;
+    }
+    uint32_t t0 = millis();
+    bool ok = _ws.sendBIN(_txBuf, len, true);
+    if (!ok) MQTTLOG("sendBIN FAILED");
+    if (millis() - t0 > MQTT_WS_SEND_STALL_MS) _saturated = true;
+    return ok;
+  }
+
   // ─── Send binary WebSocket frame ──────────
   bool _wsSend(const std::vector<uint8_t>& pkt) {
     if (!_wsReady) {
@@ -0,0 +1,119 @@
+#pragma once
+#include "RecordRing.h"
+
+// ─────────────────────────────────────────────
+//  PublishQueue — RAM buffer of publishes made while the broker is away
+//
+//  Record layout inside the ring:
+//    [flags:u8 = retain | qos<<1][topicLen:u16][topic][\0][payload]
+//  The topic is stored NUL-terminated so peek() can return it directly.
+// ─────────────────────────────────────────────
+enum PublishDropPolicy {
+  DROP_OLDEST,
+  DROP_NEWEST
+};
+
+struct PendingPublish {
+  const char* topic;
+  const uint8_t* payload;
+  size_t length;
+  bool retained;
+  uint8_t qos;
+};
+
+struct OfflineQueueStats {
+  uint32_t depth = 0;       // messages currently queued
+  uint32_t bytes = 0;       // bytes currently queued
+  uint32_t queued = 0;      // total accepted
+  uint32_t dropped = 0;     // total dropped (either policy)
+  uint32_t drained = 0;     // total sent after reconnect
+  uint32_t lastDrainMs = 0; // reconnect → queue empty, last time it drained
+};
+
+class PublishQueue {
+public:
+  void configure(size_t maxBytes, uint16_t maxMessages, PublishDropPolicy policy) {
+    _ring.reset(maxBytes);
+    _maxMessages = maxMessages;
+    _policy = policy;
+  }
+
+  bool push(const char* topic, const uint8_t* payload, size_t length,
+            bool retained, uint8_t qos) {
+    size_t topicLen = strlen(topic);
+    size_t len = 3 + topicLen + 1 + length;
+    if (len + 2 > _ring.capacity() || len > RecordRing::MAX_RECORD || _maxMessages == 0) {
+      _stats.dropped++;
+      return false;
+    }
+
+    uint8_t* p;
+    for (;;) {
+      p = _ring.count() < _maxMessages ? _ring.reserve(len) : nullptr;
+      if (p)
+        break;
+      if (_policy == DROP_NEWEST || _ring.empty()) {
+        _stats.dropped++;
+        return false;
+      }
+      _ring.pop();
+      _stats.dropped++;
+    }
+
+    *p++ = (retained ? 0x01 : 0x00) | (qos << 1);
+    *p++ = topicLen >> 8;
+    *p++ = topicLen & 0xFF;
+    memcpy(p, topic, topicLen);
+    p += topicLen;
+    *p++ = '\0';
+    if (length)
+      memcpy(p, payload, length);
+    _ring.commit(len);
+    _stats.queued++;
+    return true;
+  }
+
+  // Oldest pending publish; pointers stay valid until pop().
+  bool peek(PendingPublish& out) {
+    uint8_t* p;
+    size_t len;
+    if (!_ring.front(p, len))
+      return false;
+    size_t topicLen = ((size_t)p[1] << 8) | p[2];
+    out.retained = p[0] & 0x01;
+    out.qos = (p[0] >> 1) & 0x03;
+    out.topic = (const char*)(p + 3);
+    out.payload = p + 3 + topicLen + 1;
+    out.length = len - (3 + topicLen + 1);
+    return true;
+  }
+
+  void pop() {
+    if (_ring.empty())
+      return;
+    _ring.pop();
+    _stats.drained++;
+  }
+
+  // Discard the oldest publish without sending it.
+  void drop() {
+    if (_ring.empty())
+      return;
+    _ring.pop();
+    _stats.dropped++;
+  }
+
+  bool empty() const { return _ring.empty(); }
+
+  OfflineQueueStats& stats() {
+    _stats.depth = _ring.count();
+    _stats.bytes = _ring.bytes();
+    return _stats;
+  }
+
+private:
+  RecordRing _ring;
+  uint16_t _maxMessages = 0;
+  PublishDropPolicy _policy = DROP_OLDEST;
+  OfflineQueueStats _stats;
+};
@@ -0,0 +1,121 @@
+#pragma once
+#include <Arduino.h>
+
+// ─────────────────────────────────────────────
+//  RecordRing — fixed-capacity FIFO of variable-length byte records
+//
+//  One buffer is allocated up front; records are stored contiguously as
+//  [len:u16][bytes], so front() can hand out a plain pointer. A record
+//  that does not fit before the end of the buffer is placed at offset 0
+//  and the skipped tail is marked with len = 0xFFFF.
+// ─────────────────────────────────────────────
+class RecordRing {
+public:
+  static const uint16_t MAX_RECORD = 0xFFFE;
+
+  explicit RecordRing(size_t capacity = 0) { reset(capacity); }
+  ~RecordRing() { delete[] _buf; }
+
+  RecordRing(const RecordRing&)            = delete;
+  RecordRing& operator=(const RecordRing&) = delete;
+
+  // Reallocate with a new capacity; drops everything queued.
+  void reset(size_t capacity) {
+    delete[] _buf;
+    _buf = capacity ? new uint8_t[capacity] : nullptr;
+    _cap = _buf ? capacity : 0;
+    clear();
+  }
+
+  void clear() {
+    _head = _tail = 0;
+    _count = 0;
+    _bytes = 0;
+    _resPos = _resLen = 0;
+  }
+
+  // Reserve a contiguous region of `len` bytes at the back of the ring.
+  // Returns nullptr if it does not fit. Nothing is queued until commit().
+  uint8_t* reserve(size_t len) {
+    if (!_buf || len > MAX_RECORD) return nullptr;
+    size_t need = 2 + len;
+
+    if (_count == 0) _head = _tail = 0;
+
+    if (_count == 0 || _tail > _head) {
+      if (_tail + need <= _cap) {
+        _resPos = _tail;
+      } else if (need <= _head) {
+        _resPos = 0;                      // wrap; tail of buffer is skipped
+      } else {
+        return nullptr;
+      }
+    } else {
+      if (_tail + need > _head) return nullptr;
+      _resPos = _tail;
+    }
+    _resLen = len;
+    return _buf + _resPos + 2;
+  }
+
+  // Queue the region obtained from the last reserve(); `len` may shrink it.
+  void commit(size_t len) {
+    if (len > _resLen) len = _resLen;
+    if (_resPos != _tail && _cap - _tail >= 2) {
+      _buf[_tail]     = 0xFF;             // wrap marker
+      _buf[_tail + 1] = 0xFF;
+    }
+    _buf[_resPos]     = len >> 8;
+    _buf[_resPos + 1] = len & 0xFF;
+    _tail  = _resPos + 2 + len;
+    _bytes += 2 + len;
+    _count++;
+    _resLen = 0;
+  }
+
+  bool push(const uint8_t* data, size_t len) {
+    uint8_t* p = reserve(len);
+    if (!p) return false;
+    if (len) memcpy(p, data, len);
+    commit(len);
+    return true;
+  }
+
+  // Oldest record; the pointer stays valid until pop()/clear().
+  bool front(uint8_t*& data, size_t& len) {
+    if (_count == 0) return false;
+    _skipWrap();
+    len  = ((size_t)_buf[_head] << 8) | _buf[_head + 1];
+    data = _buf + _head + 2;
+    return true;
+  }
+
+  void pop() {
+    if (_count == 0) return;
+    _skipWrap();
+    size_t len = ((size_t)_buf[_head] << 8) | _buf[_head + 1];
+    _head  += 2 + len;
+    _bytes -= 2 + len;
+    if (--_count == 0) _head = _tail = 0;
+  }
+
+  bool   empty()    const { return _count == 0; }
+  size_t count()    const { return _count; }
+  size_t bytes()    const { return _bytes; }     // queued, incl. 2-byte headers
+  size_t capacity() const { return _cap; }
+
+private:
+  uint8_t* _buf    = nullptr;
+  size_t   _cap    = 0;
+  size_t   _head   = 0;
+  size_t   _tail   = 0;
+  size_t   _count  = 0;
+  size_t   _bytes  = 0;
+  size_t   _resPos = 0;
+  size_t   _resLen = 0;
+
+  void _skipWrap() {
+    if (_cap - _head < 2 || (_buf[_head] == 0xFF && _buf[_head + 1] == 0xFF))
+      _head = 0;
+  }
+};
@@ -0,0 +1,136 @@
+#pragma once
+#include <Arduino.h>
+
+// ─────────────────────────────────────────────
+//  TimeSeries — fixed-memory history of one numeric attribute
+//
+//  Level 0 keeps the last TS_RAW_SAMPLES raw samples. Each rollup level
+//  closes a min/max/avg bucket every TS_ROLLUP_1_SEC / TS_ROLLUP_2_SEC
+//  seconds and keeps the last TS_ROLLUP_SAMPLES of them. All storage is
+//  allocated in the constructor; add() never allocates.
+// ─────────────────────────────────────────────
+#ifndef TS_RAW_SAMPLES
+  #define TS_RAW_SAMPLES 120
+#endif
+#ifndef TS_ROLLUP_SAMPLES
+  #define TS_ROLLUP_SAMPLES 96
+#endif
+#ifndef TS_ROLLUP_1_SEC
+  #define TS_ROLLUP_1_SEC 60      // 96 × 1 min  = 1.6 h
+#endif
+#ifndef TS_ROLLUP_2_SEC
+  #define TS_ROLLUP_2_SEC 900     // 96 × 15 min = 24 h
+#endif
+
+// Raw samples have min == max == avg.
+struct TimeSeriesPoint {
+  uint32_t t;     // bucket start (rollups) or sample time, seconds
+  float    min;
+  float    max;
+  float    avg;
+};
+
+class TimeSeries {
+public:
+  static const uint8_t LEVELS = 3;
+
+  TimeSeries() {
+    _levels[0].init(TS_RAW_SAMPLES, 0);
+    _levels[1].init(TS_ROLLUP_SAMPLES, TS_ROLLUP_1_SEC);
+    _levels[2].init(TS_ROLLUP_SAMPLES, TS_ROLLUP_2_SEC);
+  }
+
+  TimeSeries(const TimeSeries&)            = delete;
+  TimeSeries& operator=(const TimeSeries&) = delete;
+
+  void add(uint32_t t, float v) {
+    _levels[0].push({t, v, v, v});
+    for (uint8_t i = 1; i < LEVELS; i++) _levels[i].accumulate(t, v);
+  }
+
+  // Level whose resolution is the coarsest one not above `sec`
+  // (0 → raw samples).
+  static uint8_t levelFor(uint32_t sec) {
+    if (sec >= TS_ROLLUP_2_SEC) return 2;
+    if (sec >= TS_ROLLUP_1_SEC) return 1;
+    return 0;
+  }
+
+  static uint32_t resolution(uint8_t level) {
+    return level == 2 ? TS_ROLLUP_2_SEC : (level == 1 ? TS_ROLLUP_1_SEC : 0);
+  }
+
+  // Calls visit(const TimeSeriesPoint&) oldest first for every point with
+  // t >= from, including the still-open bucket of a rollup level.
+  template <typename F>
+  size_t query(uint8_t level, uint32_t from, F&& visit) const {
+    if (level >= LEVELS) return 0;
+    const Level& l = _levels[level];
+    size_t hits = 0;
+    for (size_t i = 0; i < l.count; i++) {
+      const TimeSeriesPoint& p = l.points[(l.head + i) % l.cap];
+      if (p.t < from) continue;
+      visit(p);
+      hits++;
+    }
+    if (l.open.n && l.open.start >= from) {
+      visit(TimeSeriesPoint{l.open.start, l.open.min, l.open.max, l.open.sum / l.open.n});
+      hits++;
+    }
+    return hits;
+  }
+
+private:
+  struct Bucket {
+    uint32_t start = 0;
+    uint32_t n     = 0;
+    float    min   = 0;
+    float    max   = 0;
+    float    sum   = 0;
+  };
+
+  struct Level {
+    TimeSeriesPoint* points = nullptr;
+    size_t           cap    = 0;
+    size_t           head   = 0;
+    size_t           count  = 0;
+    uint32_t         width  = 0;   // bucket length in seconds, 0 = raw
+    Bucket           open;
+
+    ~Level() { delete[] points; }
+
+    void init(size_t capacity, uint32_t bucketSec) {
+      points = new TimeSeriesPoint[capacity];
+      cap    = capacity;
+      width  = bucketSec;
+    }
+
+    void push(const TimeSeriesPoint& p) {
+      if (count < cap) {
+        points[(head + count++) % cap] = p;
+      } else {
+        points[head] = p;               // overwrite the oldest
+        head = (head + 1) % cap;
+      }
+    }
+
+    void accumulate(uint32_t t, float v) {
+      uint32_t start = t - t % width;
+      if (open.n && start != open.start) {
+        push({open.start, open.min, open.max, open.sum / open.n});
+        open.n = 0;
+      }
+      if (open.n == 0) {
+        open.start = start;
+        open.min = open.max = v;
+        open.sum = 0;
+      }
+      if (v < open.min) open.min = v;
+      if (v > open.max) open.max = v;
+      open.sum += v;
+      open.n++;
+    }
+  };
+
+  Level _levels[LEVELS];
+};
@@ -0,0 +1,173 @@
+#pragma once
+#include <Arduino.h>
+#include <vector>
+
+// ─────────────────────────────────────────────
+//  TopicTrie — MQTT topic-filter index with + and # wildcards
+//
+//  One node per filter level; literal children are kept sorted so a
+//  lookup is a binary search per level, and '+' / '#' children hang off
+//  dedicated pointers. match() walks the topic once, so dispatch cost
+//  depends on the number of topic levels, not the number of filters.
+//  Topics starting with '$' are not matched by a leading wildcard.
+// ─────────────────────────────────────────────
+template <typename T>
+class TopicTrie {
+public:
+  TopicTrie() = default;
+  ~TopicTrie() { clear(); }
+
+  TopicTrie(const TopicTrie&)            = delete;
+  TopicTrie& operator=(const TopicTrie&) = delete;
+
+  // Adds `value` under `filter`. Returns false for an invalid filter.
+  bool insert(const String& filter, const T& value) {
+    if (!valid(filter)) return false;
+    Node* n = &_root;
+    _walk(filter, [&](const char* s, size_t len) {
+      if (len == 1 && s[0] == '+') {
+        if (!n->plus) n->plus = new Node();
+        n = n->plus;
+      } else if (len == 1 && s[0] == '#') {
+        if (!n->hash) n->hash = new Node();
+        n = n->hash;
+      } else {
+        n = _child(n, s, len, true);
+      }
+    });
+    n->values.push_back(value);
+    _size++;
+    return true;
+  }
+
+  // Drops every value stored under `filter`.
+  bool remove(const String& filter) {
+    Node* n = &_root;
+    _walk(filter, [&](const char* s, size_t len) {
+      if (!n) return;
+      if (len == 1 && s[0] == '+')      n = n->plus;
+      else if (len == 1 && s[0] == '#') n = n->hash;
+      else                              n = _child(n, s, len, false);
+    });
+    if (!n || n->values.empty()) return false;
+    _size -= n->values.size();
+    n->values.clear();
+    return true;
+  }
+
+  // Calls visit(const T&) for every value whose filter matches the topic.
+  // Returns the number of matches.
+  template <typename F>
+  size_t match(const char* topic, size_t len, F&& visit) const {
+    size_t hits = 0;
+    _match(&_root, topic, topic + len, false, true, visit, hits);
+    return hits;
+  }
+
+  void clear() {
+    _free(_root);
+    _root = Node();
+    _size = 0;
+  }
+
+  size_t size() const { return _size; }
+
+  static bool valid(const String& filter) {
+    size_t n = filter.length();
+    if (n == 0) return false;
+    const char* s = filter.c_str();
+    for (size_t i = 0; i < n; i++) {
+      bool levelStart = (i == 0 || s[i - 1] == '/');
+      bool levelEnd   = (i + 1 == n || s[i + 1] == '/');
+      if (s[i] == '+' && !(levelStart && levelEnd)) return false;
+      if (s[i] == '#' && !(levelStart && i + 1 == n)) return false;
+    }
+    return true;
+  }
+
+private:
+  struct Node {
+    String             level;
+    std::vector<Node*> children;   // sorted by level
+    Node*              plus = nullptr;
+    Node*              hash = nullptr;
+    std::vector<T>     values;
+  };
+
+  Node   _root;
+  size_t _size = 0;
+
+  template <typename F>
+  static void _walk(const String& filter, F&& fn) {
+    const char* s   = filter.c_str();
+    const char* end = s + filter.length();
+    for (;;) {
+      const char* e = s;
+      while (e < end && *e != '/') e++;
+      fn(s, (size_t)(e - s));
+      if (e == end) break;
+      s = e + 1;
+    }
+  }
+
+  static int _cmp(const String& level, const char* s, size_t len) {
+    size_t n = level.length() < len ? level.length() : len;
+    int c = memcmp(level.c_str(), s, n);
+    if (c) return c;
+    return level.length() < len ? -1 : (level.length() > len ? 1 : 0);
+  }
+
+  // Binary search for a literal child; optionally inserts it in order.
+  static Node* _child(Node* n, const char* s, size_t len, bool create) {
+    size_t lo = 0, hi = n->children.size();
+    while (lo < hi) {
+      size_t mid = (lo + hi) / 2;
+      int c = _cmp(n->children[mid]->level, s, len);
+      if (c == 0) return n->children[mid];
+      if (c < 0) lo = mid + 1;
+      else       hi = mid;
+    }
+    if (!create) return nullptr;
+    Node* c = new Node();
+    c->level = String(s, len);
+    n->children.insert(n->children.begin() + lo, c);
+    return c;
+  }
+
+  // `s` is the start of the next topic level; `done` means no levels left.
+  template <typename F>
+  static void _match(const Node* n, const char* s, const char* end, bool done,
+                     bool first, F& visit, size_t& hits) {
+    bool sys = first && !done && s < end && *s == '$';
+
+    // '#' also matches the parent level itself ("a/#" matches "a")
+    if (n->hash && !sys) {
+      for (const T& v : n->hash->values) visit(v);
+      hits += n->hash->values.size();
+    }
+
+    if (done) {
+      for (const T& v : n->values) visit(v);
+      hits += n->values.size();
+      return;
+    }
+
+    const char* e = s;
+    while (e < end && *e != '/') e++;
+    bool        last = (e == end);
+    const char* next = last ? end : e + 1;
+
+    if (const Node* c = _child(const_cast<Node*>(n), s, e - s, false))
+      _match(c, next, end, last, false, visit, hits);
+    if (n->plus && !sys)
+      _match(n->plus, next, end, last, false, visit, hits);
+  }
+
+  static void _free(Node& n) {
+    for (Node* c : n.children) { _free(*c); delete c; }
+    if (n.plus) { _free(*n.plus); delete n.plus; }
+    if (n.hash) { _free(*n.hash); delete n.hash; }
+    n.children.clear();
+    n.plus = n.hash = nullptr;
+  }
+};
@@ -0,0 +1,47 @@
+#pragma once
+#include <stdlib.h>
+#include <stddef.h>
+#include <new>
+
+// ─────────────────────────────────────────────
+//  Counts heap allocations made through operator new. Include from
+//  exactly one translation unit per test binary (it replaces the
+//  global operators).
+// ─────────────────────────────────────────────
+struct AllocStats {
+  size_t allocs = 0;
+  size_t bytes  = 0;
+  size_t live   = 0;   // blocks allocated and not yet freed
+};
+
+inline AllocStats& allocStats() { static AllocStats s; return s; }
+
+inline void* countedAlloc(size_t n) {
+  allocStats().allocs++;
+  allocStats().live++;
+  allocStats().bytes += n;
+  if (void* p = malloc(n ? n : 1)) return p;
+  throw std::bad_alloc();
+}
+
+void* operator new(size_t n)   { return countedAlloc(n); }
+void* operator new[](size_t n) { return countedAlloc(n); }
+inline void countedFree(void* p) {
+  if (!p) return;
+  allocStats().live--;
+  free(p);
+}
+
+void operator delete(void* p) noexcept            { countedFree(p); }
+void operator delete[](void* p) noexcept          { countedFree(p); }
+void operator delete(void* p, size_t) noexcept    { countedFree(p); }
+void operator delete[](void* p, size_t) noexcept  { countedFree(p); }
+
+// Allocations made while running fn()
+template <typename F>
+AllocStats countAllocs(F&& fn) {
+  AllocStats before = allocStats();
+  fn();
+  return {allocStats().allocs - before.allocs, allocStats().bytes - before.bytes,
+          allocStats().live - before.live};
+}
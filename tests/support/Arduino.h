@@ -0,0 +1,63 @@
+#pragma once
+// ─────────────────────────────────────────────
+//  Host shim for the native test env — just enough of the Arduino core
+//  for the header-only parts of the library (RecordRing, PublishQueue,
+//  TopicTrie, MQTTWebSocket). Not a general-purpose Arduino emulation.
+// ─────────────────────────────────────────────
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string>
+
+// Tests move time forward explicitly
+inline uint32_t& hostMillis() { static uint32_t t = 0; return t; }
+inline uint32_t  millis()     { return hostMillis(); }
+
+inline long random(long max)          { return max > 0 ? rand() % max : 0; }
+inline long random(long min, long max) { return min + random(max - min); }
+
+class String {
+public:
+  String() {}
+  String(const char* s) : _s(s ? s : "") {}
+  String(const char* s, size_t n) : _s(s, n) {}
+  String(int v) : _s(std::to_string(v)) {}
+  String(unsigned v) : _s(std::to_string(v)) {}
+
+  const char* c_str() const { return _s.c_str(); }
+  size_t length() const     { return _s.size(); }
+  const char* begin() const { return _s.data(); }
+  const char* end() const   { return _s.data() + _s.size(); }
+
+  String& operator+=(const String& o) { _s += o._s; return *this; }
+  friend String operator+(String a, const String& b)      { return a += b; }
+  friend String operator+(const char* a, const String& b) { return String(a) += b; }
+
+  bool operator==(const String& o) const { return _s == o._s; }
+  bool operator!=(const String& o) const { return _s != o._s; }
+  bool operator<(const String& o) const  { return _s < o._s; }
+
+private:
+  std::string _s;
+};
+
+struct HostSerial {
+  bool verbose = false;
+  void printf(const char* fmt, ...) {
+    if (!verbose) return;
+    va_list ap;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+  }
+  void println(const String& s = String()) { if (verbose) puts(s.c_str()); }
+};
+inline HostSerial Serial;
+
+struct HostEsp {
+  uint32_t getFreeHeap() { return 0; }
+};
+inline HostEsp ESP;
@@ -0,0 +1,16 @@
+#pragma once
+#include "MQTTWebSocket.h"
+
+// Brings `mqtt` up to an accepted CONNACK against the WebSocketsClient
+// shim and returns the shim, with the CONNECT already cleared from
+// ws.sent.
+inline WebSocketsClient& connectMqtt(MQTTWebSocket& mqtt) {
+  mqtt.begin("broker.test", 443, "/mqtt", true);
+  WebSocketsClient& ws = *WebSocketsClient::last();
+  ws.emit(WStype_CONNECTED);
+  mqtt.loop();                                   // deferred CONNECT
+  uint8_t connack[] = {MQTT_CONNACK, 0x02, 0x00, 0x00};
+  ws.emit(WStype_BIN, connack, sizeof(connack));
+  ws.sent.clear();
+  return ws;
+}
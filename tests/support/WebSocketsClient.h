@@ -0,0 +1,91 @@
+#pragma once
+#include <Arduino.h>
+#include <WiFiClient.h>
+#include <functional>
+#include <vector>
+
+// ─────────────────────────────────────────────
+//  Host shim for links2004/WebSockets. Nothing touches the network:
+//  sendBIN() records the frames, and tests inject events with emit().
+//  loop() mimics the reconnect logic: while the TCP side is down it
+//  makes one attempt per reconnect interval, which succeeds or fails
+//  as the test sets connectSucceeds.
+// ─────────────────────────────────────────────
+#define WEBSOCKETS_MAX_HEADER_SIZE (14)
+
+typedef enum {
+  WStype_ERROR,
+  WStype_DISCONNECTED,
+  WStype_CONNECTED,
+  WStype_TEXT,
+  WStype_BIN,
+  WStype_FRAGMENT_TEXT_START,
+  WStype_FRAGMENT_BIN_START,
+  WStype_FRAGMENT,
+  WStype_FRAGMENT_FIN,
+  WStype_PING,
+  WStype_PONG,
+} WStype_t;
+
+struct WSclient_t {
+  WiFiClient* tcp = nullptr;
+};
+
+class WebSocketsClient {
+public:
+  typedef std::function<void(WStype_t type, uint8_t* payload, size_t length)> WebSocketClientEvent;
+
+  WebSocketsClient()  { last() = this; }
+
+  void begin(const char*, uint16_t, const char* = "/", const char* = "arduino") {}
+  void beginSSL(const char*, uint16_t, const char* = "/", const char* = "", const char* = "arduino") {}
+  void setExtraHeaders(const char* = nullptr) {}
+  void setReconnectInterval(unsigned long ms) { _reconnectInterval = ms; }
+  void enableHeartbeat(uint32_t, uint32_t, uint8_t) {}
+  void onEvent(WebSocketClientEvent cb) { _cb = cb; }
+  void loop() {
+    if (clientIsConnected(&_client)) return;
+    if (_reconnectInterval && millis() - _lastConnectionFail < _reconnectInterval) return;
+    connectCalls++;
+    if (connectSucceeds) tcpUp = true;
+    else _lastConnectionFail = millis();
+  }
+  void disconnect() { tcpUp = false; }
+
+  bool sendBIN(uint8_t* payload, size_t length, bool headerToPayload = false) {
+    const uint8_t* p = headerToPayload ? payload + WEBSOCKETS_MAX_HEADER_SIZE : payload;
+    hostMillis() += stallMs;
+    if (failSends) return false;
+    sentBytes += length;
+    if (keepFrames) sent.push_back(std::vector<uint8_t>(p, p + length));
+    return true;
+  }
+  bool sendBIN(const uint8_t* payload, size_t length) {
+    return sendBIN(const_cast<uint8_t*>(payload), length, false);
+  }
+
+  // ── Test hooks ────────────────────────────
+  static WebSocketsClient*& last() { static WebSocketsClient* c = nullptr; return c; }
+
+  void emit(WStype_t type, uint8_t* payload = nullptr, size_t length = 0) {
+    if (_cb) _cb(type, payload, length);
+  }
+  std::vector<std::vector<uint8_t>> sent;
+  bool   keepFrames = true;   // off for benchmarks: storing frames allocates
+  size_t sentBytes  = 0;
+  uint32_t stallMs  = 0;      // time each sendBIN() takes
+  bool   failSends  = false;  // sendBIN() returns false and sends nothing
+  bool   tcpUp           = false;
+  bool   connectSucceeds = false;
+  int    connectCalls    = 0;
+
+protected:
+  WSclient_t    _client;
+  unsigned long _lastConnectionFail = 0;
+  unsigned long _reconnectInterval  = 500;
+
+  bool clientIsConnected(WSclient_t*) { return tcpUp; }
+
+private:
+  WebSocketClientEvent _cb;
+};
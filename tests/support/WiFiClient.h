@@ -0,0 +1,9 @@
+#pragma once
+#include <Arduino.h>
+
+// Host shim: only what MQTTWebSocket asks of the socket under the WS
+class WiFiClient {
+public:
+  int fd() const   { return -1; }
+  int available()  { return 0; }
+};
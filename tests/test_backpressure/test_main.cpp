@@ -0,0 +1,169 @@
+// ─────────────────────────────────────────────
+//  MQTTWebSocket backpressure: WOULD_BLOCK from either the outbound
+//  queue or the QoS 1 window must be followed by exactly one
+//  onWritable once there is room again. QoS 1 retries never overtake
+//  the outbound queue.
+// ─────────────────────────────────────────────
+#include <unity.h>
+#include "MQTTHarness.h"
+
+static void pubAck(WebSocketsClient& ws, uint16_t pid) {
+  uint8_t pkt[] = {MQTT_PUBACK, 0x02, (uint8_t)(pid >> 8), (uint8_t)(pid & 0xFF)};
+  ws.emit(WStype_BIN, pkt, sizeof(pkt));
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_full_window_fires_writable_on_puback() {
+  MQTTWebSocket mqtt;
+  int writable = 0;
+  mqtt.onWritable([&] { writable++; });
+  mqtt.setMaxInflight(2);
+  WebSocketsClient& ws = connectMqtt(mqtt);
+  const uint8_t p[] = {'1'};
+
+  TEST_ASSERT_EQUAL(MQTT_PUB_OK, mqtt.tryPublish("t", p, 1, false, 1));
+  uint16_t first = mqtt.lastPacketId();
+  TEST_ASSERT_EQUAL(MQTT_PUB_OK, mqtt.tryPublish("t", p, 1, false, 1));
+  TEST_ASSERT_TRUE(!mqtt.writable());
+  TEST_ASSERT_EQUAL(MQTT_PUB_WOULD_BLOCK, mqtt.tryPublish("t", p, 1, false, 1));
+  TEST_ASSERT_EQUAL(0, writable);
+
+  pubAck(ws, first);
+  TEST_ASSERT_EQUAL(1, writable);
+  TEST_ASSERT_TRUE(mqtt.writable());
+  TEST_ASSERT_EQUAL(MQTT_PUB_OK, mqtt.tryPublish("t", p, 1, false, 1));
+}
+
+void test_expired_slot_fires_writable() {
+  MQTTWebSocket mqtt;
+  int writable = 0;
+  mqtt.onWritable([&] { writable++; });
+  mqtt.setMaxInflight(1);
+  connectMqtt(mqtt);
+  const uint8_t p[] = {'1'};
+
+  TEST_ASSERT_EQUAL(MQTT_PUB_OK, mqtt.tryPublish("t", p, 1, false, 1));
+  TEST_ASSERT_EQUAL(MQTT_PUB_WOULD_BLOCK, mqtt.tryPublish("t", p, 1, false, 1));
+  for (int i = 0; i <= MQTT_WS_MAX_RETRIES; i++) {
+    hostMillis() += MQTT_WS_RETRY_MS;
+    mqtt.loop();
+  }
+  TEST_ASSERT_EQUAL(1, writable);
+  TEST_ASSERT_EQUAL(1, mqtt.stats().expired);
+}
+
+void test_rejected_puback_counted_once() {
+  MQTTWebSocket mqtt;
+  mqtt.setProtocolVersion(5);
+  int done = 0, acked = 0;
+  mqtt.onPublishComplete([&](uint16_t, bool ok) { done++; acked += ok; });
+  WebSocketsClient& ws = connectMqtt(mqtt);
+  const uint8_t p[] = {'1'};
+
+  TEST_ASSERT_EQUAL(MQTT_PUB_OK, mqtt.tryPublish("t", p, 1, false, 1));
+  uint16_t pid = mqtt.lastPacketId();
+  uint8_t pkt[] = {MQTT_PUBACK, 0x03, (uint8_t)(pid >> 8), (uint8_t)(pid & 0xFF), 0x87};
+  ws.emit(WStype_BIN, pkt, sizeof(pkt));
+
+  TEST_ASSERT_EQUAL(1, done);
+  TEST_ASSERT_EQUAL(0, acked);
+  TEST_ASSERT_EQUAL(1, mqtt.stats().rejected);
+  TEST_ASSERT_EQUAL(0, mqtt.stats().expired);
+  TEST_ASSERT_EQUAL(0, mqtt.stats().acked);
+}
+
+// PUBLISH frames for `pid`, and how many of them carry DUP
+static int publishesOf(WebSocketsClient& ws, uint16_t pid, int* dups) {
+  int n = 0;
+  *dups = 0;
+  for (auto& f : ws.sent) {
+    if ((f[0] & 0xF0) != MQTT_PUBLISH || f.size() < 7) continue;
+    size_t at = 4 + ((f[2] << 8) | f[3]);
+    if (((f[at] << 8) | f[at + 1]) != pid) continue;
+    n++;
+    if (f[0] & 0x08) (*dups)++;
+  }
+  return n;
+}
+
+void test_retry_waits_for_queued_original() {
+  MQTTWebSocket mqtt;
+  WebSocketsClient& ws = connectMqtt(mqtt);
+  const uint8_t p[] = {'1'};
+
+  ws.stallMs = MQTT_WS_SEND_STALL_MS + 1;        // socket backs up
+  TEST_ASSERT_EQUAL(MQTT_PUB_OK, mqtt.tryPublish("t", p, 1));
+  ws.stallMs = 0;
+  TEST_ASSERT_EQUAL(MQTT_PUB_QUEUED, mqtt.tryPublish("t", p, 1, false, 1));
+  uint16_t pid = mqtt.lastPacketId();
+
+  // Original left the queue only after the retry interval: no DUP yet
+  hostMillis() += MQTT_WS_RETRY_MS + 1;
+  mqtt.loop();
+  mqtt.loop();
+  int dups;
+  TEST_ASSERT_EQUAL(1, publishesOf(ws, pid, &dups));
+  TEST_ASSERT_EQUAL(0, dups);
+  TEST_ASSERT_EQUAL(0, mqtt.stats().retransmits);
+
+  hostMillis() += MQTT_WS_RETRY_MS;
+  mqtt.loop();
+  TEST_ASSERT_EQUAL(2, publishesOf(ws, pid, &dups));
+  TEST_ASSERT_EQUAL(1, dups);
+}
+
+// After a reconnect only a packet that reached the socket is a
+// re-delivery; one dropped from the queue goes out without DUP
+void test_reconnect_dup_only_for_sent() {
+  MQTTWebSocket mqtt;
+  WebSocketsClient& ws = connectMqtt(mqtt);
+  const uint8_t p[] = {'1'};
+
+  TEST_ASSERT_EQUAL(MQTT_PUB_OK, mqtt.tryPublish("t", p, 1, false, 1));
+  uint16_t sentPid = mqtt.lastPacketId();
+  ws.stallMs = MQTT_WS_SEND_STALL_MS + 1;        // socket backs up
+  TEST_ASSERT_EQUAL(MQTT_PUB_OK, mqtt.tryPublish("t", p, 1));
+  ws.stallMs = 0;
+  TEST_ASSERT_EQUAL(MQTT_PUB_QUEUED, mqtt.tryPublish("t", p, 1, false, 1));
+  uint16_t queuedPid = mqtt.lastPacketId();
+
+  ws.emit(WStype_DISCONNECTED);
+  ws.sent.clear();
+  ws.emit(WStype_CONNECTED);
+  mqtt.loop();
+  uint8_t connack[] = {MQTT_CONNACK, 0x02, 0x00, 0x00};
+  ws.emit(WStype_BIN, connack, sizeof(connack));
+
+  int dups;
+  TEST_ASSERT_EQUAL(1, publishesOf(ws, sentPid, &dups));
+  TEST_ASSERT_EQUAL(1, dups);
+  TEST_ASSERT_EQUAL(1, publishesOf(ws, queuedPid, &dups));
+  TEST_ASSERT_EQUAL(0, dups);
+  TEST_ASSERT_EQUAL(1, mqtt.stats().retransmits);
+}
+
+void test_no_writable_without_would_block() {
+  MQTTWebSocket mqtt;
+  int writable = 0;
+  mqtt.onWritable([&] { writable++; });
+  WebSocketsClient& ws = connectMqtt(mqtt);
+  const uint8_t p[] = {'1'};
+
+  mqtt.tryPublish("t", p, 1, false, 1);
+  pubAck(ws, mqtt.lastPacketId());
+  mqtt.loop();
+  TEST_ASSERT_EQUAL(0, writable);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_full_window_fires_writable_on_puback);
+  RUN_TEST(test_expired_slot_fires_writable);
+  RUN_TEST(test_rejected_puback_counted_once);
+  RUN_TEST(test_retry_waits_for_queued_original);
+  RUN_TEST(test_reconnect_dup_only_for_sent);
+  RUN_TEST(test_no_writable_without_would_block);
+  return UNITY_END();
+}
@@ -0,0 +1,212 @@
+// ─────────────────────────────────────────────
+//  GorillaCodec: encode → decode round trips (constant, jittered and
+//  non-finite values, every delta-of-delta width up to the 32-bit gap
+//  path), plus a benchmark of bytes per sample and encode throughput.
+//
+//    pio test -e native -f test_gorilla -v
+// ─────────────────────────────────────────────
+#include <unity.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <random>
+#include <vector>
+#include "GorillaCodec.h"
+
+struct Sample {
+  uint64_t t;
+  float    v;
+};
+
+// Encodes `in` into a buffer sized with capacityFor(), decodes it and
+// checks every sample bit for bit (so NaN payloads and -0.0 count).
+// The encoded size goes to `bytes`.
+static void roundTrip(const std::vector<Sample>& in, size_t* bytes = nullptr) {
+  std::vector<uint8_t> buf(GorillaEncoder::capacityFor(in.size()));
+  GorillaEncoder enc;
+  enc.begin(buf.data(), buf.size());
+  for (const Sample& s : in) TEST_ASSERT_TRUE(enc.add(s.t, s.v));
+  TEST_ASSERT_EQUAL(in.size(), enc.count());
+
+  GorillaDecoder dec(buf.data(), enc.size());
+  TEST_ASSERT_EQUAL(in.size(), dec.count());
+  for (size_t i = 0; i < in.size(); i++) {
+    uint64_t t;
+    float v;
+    TEST_ASSERT_TRUE(dec.next(t, v));
+    TEST_ASSERT_EQUAL_UINT64(in[i].t, t);
+    TEST_ASSERT_EQUAL_MEMORY(&in[i].v, &v, sizeof(float));
+  }
+  uint64_t t;
+  float v;
+  TEST_ASSERT_FALSE(dec.next(t, v));
+  if (bytes) *bytes = enc.size();
+}
+
+static std::vector<Sample> jittered(size_t n, uint32_t seed, uint64_t t0 = 1700000000000ULL) {
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<int> jitter(-40, 40);
+  std::normal_distribution<float> noise(0.0f, 0.3f);
+  std::vector<Sample> out;
+  uint64_t t = t0;
+  float v = 21.5f;
+  for (size_t i = 0; i < n; i++) {
+    out.push_back({t, v});
+    t += 1000 + jitter(rng);
+    v += noise(rng);
+  }
+  return out;
+}
+
+void setUp() {}
+void tearDown() {}
+
+// ── Round trips ───────────────────────────────
+void test_single_sample() {
+  roundTrip({{42, 3.5f}});
+}
+
+void test_constant_series() {
+  std::vector<Sample> in;
+  for (int i = 0; i < 500; i++) in.push_back({1000ULL * i, 23.25f});
+  size_t bytes = 0;
+  roundTrip(in, &bytes);
+  // Header, then the first delta (a 12-bit dod) and 1 + 1 bits per
+  // sample from there on
+  size_t bits = GorillaEncoder::HEADER_BITS + 4 + 12 + 1 + 498 * 2;
+  TEST_ASSERT_EQUAL((bits + 7) / 8, bytes);
+}
+
+void test_jittered_series() {
+  roundTrip(jittered(1000, 1));
+  roundTrip(jittered(1000, 2, 0));
+}
+
+void test_non_finite_values() {
+  const float inf = std::numeric_limits<float>::infinity();
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  roundTrip({{0, nan}, {10, nan}, {20, inf}, {30, -inf}, {40, 0.0f}, {50, -0.0f},
+             {60, 1.0f}, {70, nan}, {80, -nan}, {90, std::numeric_limits<float>::denorm_min()},
+             {100, std::numeric_limits<float>::max()}, {110, -std::numeric_limits<float>::max()}});
+}
+
+void test_every_dod_width() {
+  // dod of 0, then each bucket's edges, then the 32-bit path both ways
+  const int64_t dods[] = {0, 1, -63, 64, 65, -64, 256, -255, 257, -256,
+                          2048, -2047, 2049, -2048, 86400000, -86400000,
+                          INT32_MAX, INT32_MIN + 1};
+  std::vector<Sample> in;
+  uint64_t t = 5000000000ULL;
+  int64_t delta = 1000;
+  in.push_back({t, 1.0f});
+  t += delta;
+  in.push_back({t, 2.0f});
+  for (int64_t dod : dods) {
+    delta += dod;                        // stays positive in this order
+    TEST_ASSERT_GREATER_THAN(0, delta);
+    t += delta;
+    in.push_back({t, (float)dod});
+  }
+  roundTrip(in);
+}
+
+void test_large_gap() {
+  // A device that was offline for a day, then resumed its 1 s cadence
+  std::vector<Sample> in = jittered(50, 3);
+  uint64_t t = in.back().t + 24ULL * 3600 * 1000;
+  for (int i = 0; i < 50; i++) in.push_back({t + 1000ULL * i, 20.0f + i});
+  roundTrip(in);
+}
+
+// ── Capacity ──────────────────────────────────
+void test_full_refuses_without_corrupting() {
+  std::vector<Sample> in = jittered(200, 4);
+  std::vector<uint8_t> buf(64);
+  GorillaEncoder enc;
+  enc.begin(buf.data(), buf.size());
+
+  size_t n = 0;
+  while (n < in.size() && !enc.full()) {
+    TEST_ASSERT_TRUE(enc.add(in[n].t, in[n].v));
+    n++;
+  }
+  TEST_ASSERT_TRUE(enc.full());
+  TEST_ASSERT_LESS_OR_EQUAL(buf.size(), enc.size());
+
+  GorillaDecoder dec(buf.data(), enc.size());
+  TEST_ASSERT_EQUAL(n, dec.count());
+  uint64_t t;
+  float v;
+  for (size_t i = 0; i < n; i++) {
+    TEST_ASSERT_TRUE(dec.next(t, v));
+    TEST_ASSERT_EQUAL_UINT64(in[i].t, t);
+  }
+}
+
+void test_truncated_stream_stops() {
+  std::vector<Sample> in = jittered(100, 5);
+  std::vector<uint8_t> buf(GorillaEncoder::capacityFor(in.size()));
+  GorillaEncoder enc;
+  enc.begin(buf.data(), buf.size());
+  for (const Sample& s : in) enc.add(s.t, s.v);
+
+  GorillaDecoder dec(buf.data(), enc.size() / 2);
+  uint64_t t;
+  float v;
+  size_t n = 0;
+  while (dec.next(t, v)) n++;
+  TEST_ASSERT_LESS_THAN(in.size(), n);
+}
+
+// ── Benchmark ─────────────────────────────────
+static void bench(const char* name, const std::vector<Sample>& in) {
+  const int N = 2000;
+  std::vector<uint8_t> buf(GorillaEncoder::capacityFor(in.size()));
+  GorillaEncoder enc;
+
+  auto t0 = std::chrono::steady_clock::now();
+  for (int r = 0; r < N; r++) {
+    enc.begin(buf.data(), buf.size());
+    for (const Sample& s : in) enc.add(s.t, s.v);
+  }
+  auto t1 = std::chrono::steady_clock::now();
+
+  // The JSON it replaces: {"ts":1700000000000,"v":21.53},
+  char json[64];
+  size_t jsonBytes = 0;
+  for (const Sample& s : in)
+    jsonBytes += snprintf(json, sizeof(json), "{\"ts\":%llu,\"v\":%.2f},",
+                          (unsigned long long)s.t, s.v);
+
+  double ns = std::chrono::duration<double, std::nano>(t1 - t0).count() / N / in.size();
+  printf("%-9s | %4u samples | bytes/sample %5.2f (JSON %5.2f) | %6.1f ns/sample, %6.1f M samples/s\n",
+         name, (unsigned)in.size(), (double)enc.size() / in.size(),
+         (double)jsonBytes / in.size(), ns, 1e3 / ns);
+  TEST_ASSERT_LESS_THAN(jsonBytes, enc.size());
+}
+
+void test_bench_encode() {
+  std::vector<Sample> constant, step;
+  for (int i = 0; i < 1000; i++) {
+    constant.push_back({1700000000000ULL + 1000ULL * i, 23.25f});
+    step.push_back({1700000000000ULL + 1000ULL * i, (float)(i / 10)});
+  }
+  bench("constant", constant);
+  bench("step", step);
+  bench("jittered", jittered(1000, 6));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_single_sample);
+  RUN_TEST(test_constant_series);
+  RUN_TEST(test_jittered_series);
+  RUN_TEST(test_non_finite_values);
+  RUN_TEST(test_every_dod_width);
+  RUN_TEST(test_large_gap);
+  RUN_TEST(test_full_refuses_without_corrupting);
+  RUN_TEST(test_truncated_stream_stops);
+  RUN_TEST(test_bench_encode);
+  return UNITY_END();
+}
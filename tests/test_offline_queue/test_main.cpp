@@ -0,0 +1,145 @@
+// ─────────────────────────────────────────────
+//  Offline publish queue: FIFO order and drop policies of PublishQueue,
+//  plus a heap benchmark against a per-message heap queue (what a
+//  std::deque of String/vector entries would do). The ring allocates
+//  once in configure(); the heap queue leaves a live block per queued
+//  message, of varying sizes — the fragmentation the ring avoids.
+//
+//    pio test -e native -f test_offline_queue -v
+// ─────────────────────────────────────────────
+#include <unity.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include "AllocCounter.h"
+#include "Arduino.h"
+#include "PublishQueue.h"
+
+static std::vector<uint8_t> payloadOf(size_t n, uint8_t seed) {
+  std::vector<uint8_t> p(n);
+  for (size_t i = 0; i < n; i++) p[i] = seed + i;
+  return p;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_fifo_order_and_fields() {
+  PublishQueue q;
+  q.configure(1024, 16, DROP_OLDEST);
+  for (uint8_t i = 0; i < 5; i++) {
+    std::vector<uint8_t> p = payloadOf(10 + i, i);
+    TEST_ASSERT_TRUE(q.push("t/a", p.data(), p.size(), i & 1, i & 1));
+  }
+  for (uint8_t i = 0; i < 5; i++) {
+    PendingPublish m;
+    TEST_ASSERT_TRUE(q.peek(m));
+    TEST_ASSERT_EQUAL_STRING("t/a", m.topic);
+    TEST_ASSERT_EQUAL(10 + i, m.length);
+    TEST_ASSERT_EQUAL(i, m.payload[0]);
+    TEST_ASSERT_EQUAL(i & 1, m.retained);
+    TEST_ASSERT_EQUAL(i & 1, m.qos);
+    q.pop();
+  }
+  TEST_ASSERT_TRUE(q.empty());
+}
+
+void test_drop_oldest_keeps_newest() {
+  PublishQueue q;
+  q.configure(256, 4, DROP_OLDEST);
+  for (uint8_t i = 0; i < 10; i++) TEST_ASSERT_TRUE(q.push("t", &i, 1, false, 0));
+  TEST_ASSERT_EQUAL(4, q.stats().depth);
+  TEST_ASSERT_EQUAL(6, q.stats().dropped);
+  PendingPublish m;
+  q.peek(m);
+  TEST_ASSERT_EQUAL(6, m.payload[0]);
+}
+
+void test_drop_newest_refuses() {
+  PublishQueue q;
+  q.configure(256, 4, DROP_NEWEST);
+  for (uint8_t i = 0; i < 10; i++) q.push("t", &i, 1, false, 0);
+  TEST_ASSERT_EQUAL(4, q.stats().depth);
+  PendingPublish m;
+  q.peek(m);
+  TEST_ASSERT_EQUAL(0, m.payload[0]);
+}
+
+void test_wraparound_keeps_records_intact() {
+  PublishQueue q;
+  q.configure(300, 64, DROP_OLDEST);
+  srand(5);
+  std::deque<std::vector<uint8_t>> expect;
+  for (int i = 0; i < 5000; i++) {
+    std::vector<uint8_t> p = payloadOf(rand() % 90, i);
+    if (q.push("wrap/topic", p.data(), p.size(), false, 0)) expect.push_back(p);
+    while (expect.size() > q.stats().depth) expect.pop_front();   // dropped oldest
+    if (rand() % 3 == 0) {
+      PendingPublish m;
+      TEST_ASSERT_TRUE(q.peek(m));
+      TEST_ASSERT_EQUAL(expect.front().size(), m.length);
+      if (m.length) TEST_ASSERT_EQUAL_MEMORY(expect.front().data(), m.payload, m.length);
+      q.pop();
+      expect.pop_front();
+    }
+  }
+}
+
+// ── Benchmark ─────────────────────────────────
+struct HeapEntry {
+  std::string          topic;
+  std::vector<uint8_t> payload;
+  HeapEntry(const char* t, const std::vector<uint8_t>& p) : topic(t), payload(p) {}
+};
+
+void test_bench_heap_use() {
+  const int    N        = 20000;
+  const size_t QUEUE    = 16 * 1024;
+  const size_t MAX_MSGS = 128;
+  srand(7);
+  std::vector<std::vector<uint8_t>> payloads;
+  for (int i = 0; i < 64; i++) payloads.push_back(payloadOf(20 + rand() % 300, i));
+
+  PublishQueue q;
+  q.configure(QUEUE, MAX_MSGS, DROP_OLDEST);
+  size_t peakRing = 0;
+  AllocStats ring = countAllocs([&] {
+    AllocStats at = allocStats();
+    for (int i = 0; i < N; i++) {
+      auto& p = payloads[i % payloads.size()];
+      q.push("device/abc/sendLiveData", p.data(), p.size(), false, 0);
+      if (i % 4 == 3) q.pop();   // drains slower than it fills
+      if (allocStats().live - at.live > peakRing) peakRing = allocStats().live - at.live;
+    }
+  });
+
+  std::deque<HeapEntry> heap;
+  size_t peakHeap = 0;
+  AllocStats naive = countAllocs([&] {
+    AllocStats at = allocStats();
+    for (int i = 0; i < N; i++) {
+      auto& p = payloads[i % payloads.size()];
+      heap.emplace_back("device/abc/sendLiveData", p);
+      if (heap.size() > MAX_MSGS) heap.pop_front();
+      if (i % 4 == 3) heap.pop_front();
+      if (allocStats().live - at.live > peakHeap) peakHeap = allocStats().live - at.live;
+    }
+  });
+
+  printf("offline queue, %d pushes | allocs/push %.2f → %.2f | peak live heap blocks %u → %u\n",
+         N, (double)naive.allocs / N, (double)ring.allocs / N,
+         (unsigned)peakHeap, (unsigned)peakRing);
+
+  TEST_ASSERT_EQUAL(0, ring.allocs);
+  TEST_ASSERT_EQUAL(0, peakRing);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_fifo_order_and_fields);
+  RUN_TEST(test_drop_oldest_keeps_newest);
+  RUN_TEST(test_drop_newest_refuses);
+  RUN_TEST(test_wraparound_keeps_records_intact);
+  RUN_TEST(test_bench_heap_use);
+  return UNITY_END();
+}
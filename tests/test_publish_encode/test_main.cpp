@@ -0,0 +1,191 @@
+// ─────────────────────────────────────────────
+//  PUBLISH encoding: correctness of the in-place encoder, plus a
+//  benchmark of heap allocations, bytes copied and time per publish
+//  against the previous vector-based encoder (kept below as reference).
+//
+//    pio test -e native -f test_publish_encode -v
+// ─────────────────────────────────────────────
+#include <unity.h>
+#include <chrono>
+#include "AllocCounter.h"
+#include "MQTTHarness.h"
+
+static const char* TOPIC = "topic/sendLiveData";
+
+// ── Reference: the encoder this replaced ──────
+// Builds `body`, then `pkt`, byte by byte; sendBIN() without
+// headerToPayload then copies `pkt` once more to prepend the WS header.
+struct LegacyEncoder {
+  uint16_t nextPid = 1;
+  size_t   copied  = 0;
+
+  void publish(const char* topic, const uint8_t* payload, size_t len, uint8_t qos) {
+    std::vector<uint8_t> body;
+    size_t tlen = strlen(topic);
+    body.push_back(tlen >> 8);
+    body.push_back(tlen & 0xFF);
+    for (size_t i = 0; i < tlen; i++) body.push_back(topic[i]);
+    if (qos == 1) {
+      uint16_t pid = nextPid++;
+      body.push_back(pid >> 8);
+      body.push_back(pid & 0xFF);
+    }
+    for (size_t i = 0; i < len; i++) body.push_back(payload[i]);
+    copied += body.size();
+
+    std::vector<uint8_t> pkt;
+    pkt.push_back(MQTT_PUBLISH | (qos == 1 ? MQTT_QOS1 : 0));
+    size_t rem = body.size();
+    do {
+      uint8_t b = rem % 128;
+      rem /= 128;
+      if (rem) b |= 0x80;
+      pkt.push_back(b);
+    } while (rem);
+    pkt.insert(pkt.end(), body.begin(), body.end());
+    copied += pkt.size();
+
+    // WebSocketsClient::sendBIN(pkt, len) without headerToPayload
+    std::vector<uint8_t> frame(WEBSOCKETS_MAX_HEADER_SIZE + pkt.size());
+    memcpy(frame.data() + WEBSOCKETS_MAX_HEADER_SIZE, pkt.data(), pkt.size());
+    copied += pkt.size();
+  }
+};
+
+static std::vector<uint8_t> payloadOf(size_t n) {
+  std::vector<uint8_t> p(n);
+  for (size_t i = 0; i < n; i++) p[i] = 'a' + i % 26;
+  return p;
+}
+
+void setUp() {}
+void tearDown() {}
+
+// ── Correctness ───────────────────────────────
+void test_qos0_wire_format() {
+  MQTTWebSocket mqtt;
+  WebSocketsClient& ws = connectMqtt(mqtt);
+  const uint8_t payload[] = {'{', '}'};
+
+  TEST_ASSERT_EQUAL(MQTT_PUB_OK, mqtt.tryPublish("a/b", payload, 2));
+  TEST_ASSERT_EQUAL(1, ws.sent.size());
+  const uint8_t expect[] = {MQTT_PUBLISH, 7, 0, 3, 'a', '/', 'b', '{', '}'};
+  TEST_ASSERT_EQUAL(sizeof(expect), ws.sent[0].size());
+  TEST_ASSERT_EQUAL_MEMORY(expect, ws.sent[0].data(), sizeof(expect));
+}
+
+void test_qos1_carries_packet_id() {
+  MQTTWebSocket mqtt;
+  WebSocketsClient& ws = connectMqtt(mqtt);
+  const uint8_t payload[] = {'x'};
+
+  TEST_ASSERT_EQUAL(MQTT_PUB_OK, mqtt.tryPublish("t", payload, 1, false, 1));
+  const std::vector<uint8_t>& pkt = ws.sent[0];
+  TEST_ASSERT_EQUAL(MQTT_PUBLISH | MQTT_QOS1, pkt[0]);
+  TEST_ASSERT_EQUAL(2 + 1 + 2 + 1, pkt[1]);
+  uint16_t pid = (pkt[5] << 8) | pkt[6];
+  TEST_ASSERT_EQUAL(mqtt.lastPacketId(), pid);
+  TEST_ASSERT_EQUAL('x', pkt[7]);
+}
+
+void test_remaining_length_varint() {
+  MQTTWebSocket mqtt;
+  WebSocketsClient& ws = connectMqtt(mqtt);
+  std::vector<uint8_t> payload = payloadOf(300);
+
+  TEST_ASSERT_EQUAL(MQTT_PUB_OK, mqtt.tryPublish("t", payload.data(), payload.size()));
+  const std::vector<uint8_t>& pkt = ws.sent[0];
+  size_t rem = 2 + 1 + 300;                    // 303 → 0xAF 0x02
+  TEST_ASSERT_EQUAL(0x80 | (rem & 0x7F), pkt[1]);
+  TEST_ASSERT_EQUAL(rem >> 7, pkt[2]);
+  TEST_ASSERT_EQUAL(1 + 2 + rem, pkt.size());
+  TEST_ASSERT_EQUAL_MEMORY(payload.data(), pkt.data() + pkt.size() - 300, 300);
+}
+
+void test_too_large_is_refused() {
+  MQTTWebSocket mqtt;
+  WebSocketsClient& ws = connectMqtt(mqtt);
+  std::vector<uint8_t> payload = payloadOf(MQTT_WS_TX_BUFFER_SIZE);
+
+  TEST_ASSERT_EQUAL(MQTT_PUB_TOO_LARGE, mqtt.tryPublish("t", payload.data(), payload.size()));
+  TEST_ASSERT_EQUAL(0, ws.sent.size());
+}
+
+// MQTT 5: a QoS 0 PUBLISH whose send failed did not teach the broker
+// its alias, so the next one must carry the full topic again
+void test_alias_kept_only_when_sent() {
+  MQTTWebSocket mqtt;
+  mqtt.setProtocolVersion(5);
+  mqtt.begin("broker.test", 443, "/mqtt", true);
+  WebSocketsClient& ws = *WebSocketsClient::last();
+  ws.emit(WStype_CONNECTED);
+  mqtt.loop();
+  uint8_t connack[] = {MQTT_CONNACK, 0x06, 0x00, 0x00, 0x03, MQTT_PROP_TOPIC_ALIAS_MAX, 0x00, 0x05};
+  ws.emit(WStype_BIN, connack, sizeof(connack));
+  ws.sent.clear();
+  const uint8_t payload[] = {'x'};
+
+  ws.failSends = true;
+  TEST_ASSERT_EQUAL(MQTT_PUB_FAILED, mqtt.tryPublish("a/b", payload, 1));
+  ws.failSends = false;
+
+  TEST_ASSERT_EQUAL(MQTT_PUB_OK, mqtt.tryPublish("a/b", payload, 1));
+  TEST_ASSERT_EQUAL(1, ws.sent.size());
+  TEST_ASSERT_EQUAL(3, (ws.sent[0][2] << 8) | ws.sent[0][3]);   // full topic
+
+  TEST_ASSERT_EQUAL(MQTT_PUB_OK, mqtt.tryPublish("a/b", payload, 1));
+  TEST_ASSERT_EQUAL(2, ws.sent.size());
+  TEST_ASSERT_EQUAL(0, (ws.sent[1][2] << 8) | ws.sent[1][3]);   // alias only
+}
+
+// ── Benchmark ─────────────────────────────────
+static void benchSize(size_t payloadLen) {
+  const int N = 20000;
+  std::vector<uint8_t> payload = payloadOf(payloadLen);
+
+  MQTTWebSocket mqtt;
+  WebSocketsClient& ws = connectMqtt(mqtt);
+  ws.keepFrames = false;
+  mqtt.tryPublish(TOPIC, payload.data(), payload.size());   // warm up
+
+  auto t0 = std::chrono::steady_clock::now();
+  AllocStats now = countAllocs([&] {
+    for (int i = 0; i < N; i++) mqtt.tryPublish(TOPIC, payload.data(), payload.size());
+  });
+  auto t1 = std::chrono::steady_clock::now();
+
+  LegacyEncoder legacy;
+  AllocStats old = countAllocs([&] {
+    for (int i = 0; i < N; i++) legacy.publish(TOPIC, payload.data(), payload.size(), 0);
+  });
+  auto t2 = std::chrono::steady_clock::now();
+
+  // In place: header, topic and payload are each written once
+  size_t copiedNow = 1 + (payloadLen + strlen(TOPIC) + 2 >= 128 ? 2 : 1) + 2 + strlen(TOPIC) + payloadLen;
+  double nsNow = std::chrono::duration<double, std::nano>(t1 - t0).count() / N;
+  double nsOld = std::chrono::duration<double, std::nano>(t2 - t1).count() / N;
+
+  printf("payload %4u B | allocs/publish %.2f → %.2f | bytes copied %5u → %5u | ns/publish %7.1f → %7.1f\n",
+         (unsigned)payloadLen, (double)old.allocs / N, (double)now.allocs / N,
+         (unsigned)(legacy.copied / N), (unsigned)copiedNow, nsOld, nsNow);
+
+  TEST_ASSERT_EQUAL(0, now.allocs);
+  TEST_ASSERT_LESS_THAN(legacy.copied / N, copiedNow);
+}
+
+void test_bench_publish() {
+  benchSize(32);
+  benchSize(256);
+  benchSize(1024);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_qos0_wire_format);
+  RUN_TEST(test_qos1_carries_packet_id);
+  RUN_TEST(test_remaining_length_varint);
+  RUN_TEST(test_too_large_is_refused);
+  RUN_TEST(test_alias_kept_only_when_sent);
+  RUN_TEST(test_bench_publish);
+  return UNITY_END();
+}
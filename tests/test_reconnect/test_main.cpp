@@ -0,0 +1,129 @@
+// ─────────────────────────────────────────────
+//  Reconnect bookkeeping: every connect attempt WebSocketsClient makes
+//  is counted in MQTTConnectionStats, including ones that fail at once
+//  (DNS miss, refused port), and the backoff spaces them out. A resumed
+//  persistent session skips the SUBSCRIBE only if every filter was granted.
+//
+//    pio test -e native -f test_reconnect
+// ─────────────────────────────────────────────
+#include <unity.h>
+#include "MQTTHarness.h"
+
+// Runs loop() every `stepMs` for `forMs`
+static void run(MQTTWebSocket& mqtt, uint32_t forMs, uint32_t stepMs = 10) {
+  for (uint32_t t = 0; t < forMs; t += stepMs) {
+    hostMillis() += stepMs;
+    mqtt.loop();
+  }
+}
+
+void setUp() { hostMillis() = 0; }
+void tearDown() {}
+
+void test_fast_failures_are_counted() {
+  MQTTWebSocket mqtt;
+  mqtt.begin("broker.test", 443, "/mqtt", true);
+  WebSocketsClient& ws = *WebSocketsClient::last();
+
+  run(mqtt, 300000);
+  TEST_ASSERT_GREATER_THAN(3, ws.connectCalls);
+  TEST_ASSERT_EQUAL(ws.connectCalls, mqtt.connectionStats().attempts);
+  TEST_ASSERT_EQUAL(0, mqtt.connectionStats().connects);
+}
+
+void test_backoff_spaces_attempts() {
+  MQTTWebSocket mqtt;
+  mqtt.begin("broker.test", 443, "/mqtt", true);
+  WebSocketsClient& ws = *WebSocketsClient::last();
+
+  // Without backoff a 2 s interval would give 150 attempts in 5 minutes;
+  // doubling up to MQTT_WS_RECONNECT_MAX_MS (with jitter) gives ~10
+  run(mqtt, 300000);
+  TEST_ASSERT_LESS_THAN(20, ws.connectCalls);
+}
+
+void test_successful_attempt_is_counted_once() {
+  MQTTWebSocket mqtt;
+  mqtt.begin("broker.test", 443, "/mqtt", true);
+  WebSocketsClient& ws = *WebSocketsClient::last();
+
+  run(mqtt, 20000);
+  uint32_t failed = mqtt.connectionStats().attempts;
+  ws.connectSucceeds = true;
+  run(mqtt, MQTT_WS_RECONNECT_MAX_MS * 2);            // connects, then waits for the WS upgrade
+  TEST_ASSERT_EQUAL(failed + 1, mqtt.connectionStats().attempts);
+
+  hostMillis() += 150;
+  ws.emit(WStype_CONNECTED);
+  TEST_ASSERT_GREATER_OR_EQUAL(150, mqtt.connectionStats().handshakeMs);
+  mqtt.loop();
+  uint8_t connack[] = {MQTT_CONNACK, 0x02, 0x00, 0x00};
+  ws.emit(WStype_BIN, connack, sizeof(connack));
+  TEST_ASSERT_EQUAL(1, mqtt.connectionStats().connects);
+  TEST_ASSERT_EQUAL(failed + 1, mqtt.connectionStats().attempts);
+}
+
+// Drops the WebSocket and brings it back up to a CONNACK with the
+// given session-present flag; returns the frames sent after CONNACK
+static std::vector<std::vector<uint8_t>> resume(MQTTWebSocket& mqtt, WebSocketsClient& ws,
+                                                 uint8_t sessionPresent) {
+  ws.emit(WStype_DISCONNECTED);
+  ws.emit(WStype_CONNECTED);
+  mqtt.loop();
+  ws.sent.clear();
+  uint8_t connack[] = {MQTT_CONNACK, 0x02, sessionPresent, 0x00};
+  ws.emit(WStype_BIN, connack, sizeof(connack));
+  return ws.sent;
+}
+
+static void subAck(WebSocketsClient& ws, const std::vector<uint8_t>& subscribe,
+                   uint8_t rc1, uint8_t rc2) {
+  uint8_t pkt[] = {MQTT_SUBACK, 0x04, subscribe[2], subscribe[3], rc1, rc2};
+  ws.emit(WStype_BIN, pkt, sizeof(pkt));
+}
+
+void test_resume_skips_granted_subscriptions() {
+  MQTTWebSocket mqtt;
+  mqtt.setPersistentSession(true);
+  mqtt.subscribe("a/1", 1);
+  mqtt.subscribe("b/#", 1);
+  mqtt.begin("broker.test", 443, "/mqtt", true);
+  WebSocketsClient& ws = *WebSocketsClient::last();
+
+  auto sent = resume(mqtt, ws, 0x00);
+  TEST_ASSERT_EQUAL(1, sent.size());
+  TEST_ASSERT_EQUAL(MQTT_SUBSCRIBE, sent[0][0]);
+  subAck(ws, sent[0], 0x01, 0x01);
+
+  TEST_ASSERT_EQUAL(0, resume(mqtt, ws, 0x01).size());
+}
+
+void test_resume_resubscribes_after_refusal() {
+  MQTTWebSocket mqtt;
+  mqtt.setPersistentSession(true);
+  mqtt.subscribe("a/1", 1);
+  mqtt.subscribe("b/#", 1);
+  mqtt.begin("broker.test", 443, "/mqtt", true);
+  WebSocketsClient& ws = *WebSocketsClient::last();
+
+  auto sent = resume(mqtt, ws, 0x00);
+  TEST_ASSERT_EQUAL(1, sent.size());
+  subAck(ws, sent[0], 0x01, 0x80);
+
+  sent = resume(mqtt, ws, 0x01);
+  TEST_ASSERT_EQUAL(1, sent.size());
+  TEST_ASSERT_EQUAL(MQTT_SUBSCRIBE, sent[0][0]);
+  subAck(ws, sent[0], 0x01, 0x01);
+
+  TEST_ASSERT_EQUAL(0, resume(mqtt, ws, 0x01).size());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_fast_failures_are_counted);
+  RUN_TEST(test_backoff_spaces_attempts);
+  RUN_TEST(test_successful_attempt_is_counted_once);
+  RUN_TEST(test_resume_skips_granted_subscriptions);
+  RUN_TEST(test_resume_resubscribes_after_refusal);
+  return UNITY_END();
+}
@@ -0,0 +1,220 @@
+// ─────────────────────────────────────────────
+//  MQTT-over-WS stream decoder: the same packet stream must decode to
+//  the same messages however the broker splits it into WS frames —
+//  one frame, 1-byte frames, random splits, and splits inside the
+//  remaining-length varint — and garbage must never crash it. A QoS 1
+//  message reaches a raw handler, PUBACK included, without allocating.
+// ─────────────────────────────────────────────
+#include <unity.h>
+#include <string>
+#include "AllocCounter.h"
+#include "MQTTHarness.h"
+
+struct Message {
+  std::string topic;
+  std::string payload;
+  bool operator==(const Message& o) const { return topic == o.topic && payload == o.payload; }
+};
+
+struct PacketStream {
+  std::vector<uint8_t> bytes;
+  std::vector<Message> expect;
+  std::vector<size_t>  varintEdges;   // offsets just after each header / varint byte
+  size_t               qos1 = 0;
+
+  void addPublish(const std::string& topic, const std::string& payload, uint8_t qos = 0) {
+    size_t rem = 2 + topic.size() + (qos ? 2 : 0) + payload.size();
+    bytes.push_back(MQTT_PUBLISH | (qos ? MQTT_QOS1 : 0));
+    varintEdges.push_back(bytes.size());
+    do {
+      uint8_t b = rem % 128;
+      rem /= 128;
+      if (rem) b |= 0x80;
+      bytes.push_back(b);
+      varintEdges.push_back(bytes.size());
+    } while (rem);
+    bytes.push_back(topic.size() >> 8);
+    bytes.push_back(topic.size() & 0xFF);
+    bytes.insert(bytes.end(), topic.begin(), topic.end());
+    if (qos) {
+      bytes.push_back(0x12);
+      bytes.push_back(0x34);
+      qos1++;
+    }
+    bytes.insert(bytes.end(), payload.begin(), payload.end());
+    expect.push_back({topic, payload});
+  }
+
+  void addPingResp() {
+    bytes.push_back(MQTT_PINGRESP);
+    bytes.push_back(0x00);
+  }
+};
+
+static std::string randomText(size_t n) {
+  std::string s(n, ' ');
+  for (auto& c : s) c = 'a' + rand() % 26;
+  return s;
+}
+
+// Payload sizes put the remaining length on both sides of each varint
+// step the RX buffer can hold (127/128 bytes, 1- vs 2-byte varint)
+static PacketStream buildStream(unsigned seed) {
+  srand(seed);
+  PacketStream st;
+  const size_t edges[] = {0, 1, 120, 121, 122, 123, 124, 125, 126, 127, 128, 300, 1500};
+  for (size_t e : edges) st.addPublish("t/x", randomText(e));
+  for (int i = 0; i < 200; i++) {
+    std::string topic = "dev/" + randomText(1 + rand() % 20);
+    size_t len = rand() % 4 == 0 ? rand() % 1800 : rand() % 64;
+    st.addPublish(topic, randomText(len), rand() % 3 == 0);
+    if (rand() % 10 == 0) st.addPingResp();
+  }
+  return st;
+}
+
+struct Receiver {
+  MQTTWebSocket        mqtt;
+  WebSocketsClient*    ws = nullptr;
+  std::vector<Message> got;
+
+  Receiver() {
+    mqtt.onMessageRaw([this](const char* topic, size_t topicLen, const uint8_t* payload, size_t len) {
+      got.push_back({std::string(topic, topicLen), std::string((const char*)payload, len)});
+    });
+    ws = &connectMqtt(mqtt);
+  }
+
+  // Every frame gets its own buffer, as it would from the socket
+  void frame(const uint8_t* data, size_t len, WStype_t type = WStype_BIN) {
+    std::vector<uint8_t> copy(data, data + len);
+    ws->emit(type, copy.data(), copy.size());
+  }
+
+  size_t pubAcks() const {
+    size_t n = 0;
+    for (auto& f : ws->sent)
+      if (!f.empty() && f[0] == MQTT_PUBACK) n++;
+    return n;
+  }
+};
+
+static void assertDecoded(const PacketStream& st, const Receiver& rx) {
+  TEST_ASSERT_EQUAL(st.expect.size(), rx.got.size());
+  for (size_t i = 0; i < st.expect.size(); i++)
+    TEST_ASSERT_TRUE_MESSAGE(st.expect[i] == rx.got[i], "message differs");
+  TEST_ASSERT_EQUAL(st.qos1, rx.pubAcks());
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_single_frame() {
+  PacketStream st = buildStream(1);
+  Receiver rx;
+  rx.frame(st.bytes.data(), st.bytes.size());
+  assertDecoded(st, rx);
+}
+
+void test_one_byte_frames() {
+  PacketStream st = buildStream(2);
+  Receiver rx;
+  for (size_t i = 0; i < st.bytes.size(); i++) rx.frame(&st.bytes[i], 1);
+  assertDecoded(st, rx);
+}
+
+void test_random_splits() {
+  for (unsigned seed = 10; seed < 60; seed++) {
+    PacketStream st = buildStream(seed);
+    Receiver rx;
+    size_t i = 0;
+    while (i < st.bytes.size()) {
+      size_t n = 1 + rand() % (rand() % 2 ? 8 : 700);
+      if (n > st.bytes.size() - i) n = st.bytes.size() - i;
+      // Mix BIN, TEXT and fragment events: all carry the same byte stream
+      WStype_t type = (i % 3 == 0) ? WStype_TEXT : (i % 3 == 1 ? WStype_FRAGMENT : WStype_BIN);
+      rx.frame(&st.bytes[i], n, type);
+      i += n;
+    }
+    assertDecoded(st, rx);
+  }
+}
+
+void test_splits_inside_varint() {
+  PacketStream st = buildStream(3);
+  Receiver rx;
+  size_t from = 0;
+  for (size_t edge : st.varintEdges) {
+    rx.frame(&st.bytes[from], edge - from);
+    from = edge;
+  }
+  rx.frame(&st.bytes[from], st.bytes.size() - from);
+  assertDecoded(st, rx);
+}
+
+void test_oversized_split_packet_is_skipped() {
+  PacketStream big;
+  big.addPublish("big", randomText(MQTT_WS_RX_BUFFER_SIZE + 100));
+  PacketStream st;
+  st.addPublish("after", "ok");
+
+  Receiver rx;
+  for (size_t i = 0; i < big.bytes.size(); i += 100)
+    rx.frame(&big.bytes[i], std::min<size_t>(100, big.bytes.size() - i));
+  rx.frame(st.bytes.data(), st.bytes.size());
+  assertDecoded(st, rx);
+}
+
+void test_malformed_length_resets_decoder() {
+  const uint8_t bad[] = {MQTT_PUBLISH, 0xFF, 0xFF, 0xFF, 0xFF, 0x01};
+  PacketStream st;
+  st.addPublish("after", "ok");
+
+  Receiver rx;
+  rx.frame(bad, 1);                     // header alone → incremental path
+  rx.frame(bad + 1, sizeof(bad) - 1);
+  rx.frame(st.bytes.data(), st.bytes.size());
+  assertDecoded(st, rx);
+}
+
+void test_garbage_does_not_crash() {
+  srand(99);
+  Receiver rx;
+  for (int i = 0; i < 2000; i++) {
+    uint8_t buf[64];
+    size_t n = 1 + rand() % sizeof(buf);
+    for (size_t k = 0; k < n; k++) buf[k] = rand();
+    rx.frame(buf, n);
+  }
+  TEST_ASSERT_TRUE(true);   // ASan/UBSan catch what matters here
+}
+
+void test_qos1_raw_delivery_does_not_allocate() {
+  MQTTWebSocket mqtt;
+  size_t got = 0;
+  mqtt.onMessageRaw([&](const char*, size_t, const uint8_t*, size_t len) { got += len; });
+  WebSocketsClient& ws = connectMqtt(mqtt);
+  ws.keepFrames = false;
+
+  PacketStream st;
+  st.addPublish("topic/action/dev1", "{\"led\":true}", 1);
+  size_t acked = ws.sentBytes;
+  AllocStats a = countAllocs([&] { ws.emit(WStype_BIN, st.bytes.data(), st.bytes.size()); });
+
+  TEST_ASSERT_EQUAL(st.expect[0].payload.size(), got);
+  TEST_ASSERT_EQUAL(acked + 4, ws.sentBytes);   // PUBACK
+  TEST_ASSERT_EQUAL(0, a.allocs);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_single_frame);
+  RUN_TEST(test_one_byte_frames);
+  RUN_TEST(test_random_splits);
+  RUN_TEST(test_splits_inside_varint);
+  RUN_TEST(test_oversized_split_packet_is_skipped);
+  RUN_TEST(test_malformed_length_resets_decoder);
+  RUN_TEST(test_garbage_does_not_crash);
+  RUN_TEST(test_qos1_raw_delivery_does_not_allocate);
+  return UNITY_END();
+}
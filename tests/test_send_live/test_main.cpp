@@ -0,0 +1,161 @@
+// ─────────────────────────────────────────────
+//  sendLive serialization: heap allocations and bytes copied per
+//  telemetry sample, for the current path (document by reference,
+//  measured and serialized straight into the MQTT-WS frame; SSE copy
+//  rendered into the reusable payloadBuf) against the previous one
+//  (document copied by value, serialized into a String for the publish
+//  and into a second String for SSE). Both are modelled on the bodies
+//  of Automata::sendLive; ArduinoJson comes from lib_deps.
+//
+//    pio test -e native -f test_send_live -v
+// ─────────────────────────────────────────────
+#include <unity.h>
+#include <string>
+#include <vector>
+#include "AllocCounter.h"
+#include "MQTTHarness.h"
+#include <ArduinoJson.h>
+
+static const char* TOPIC = "topic/sendLiveData";
+static const std::string DEVICE_ID = "6650a3c1e2b4f01d9a8c7e55";
+
+// Routes ArduinoJson's pool and string allocations through the counter
+struct CountingJsonAllocator : ArduinoJson::Allocator {
+  void* allocate(size_t n) override { return countedAlloc(n); }
+  void deallocate(void* p) override { countedFree(p); }
+  void* reallocate(void* p, size_t n) override {
+    allocStats().allocs++;
+    allocStats().bytes += n;
+    return realloc(p, n);
+  }
+};
+static CountingJsonAllocator jsonAlloc;
+
+static void fillSample(JsonDocument& doc, int i) {
+  doc["temp"]     = 23.5 + (i % 10) * 0.1;
+  doc["humidity"] = 41.2;
+  doc["pressure"] = 1013.25;
+  doc["rssi"]     = -61 - (i % 5);
+  doc["status"]   = "ok";
+}
+
+// ── Reference: sendLive(JsonDocument data) before it took a reference ──
+struct LegacySender {
+  MQTTWebSocket& mqtt;
+  size_t copied = 0;
+
+  explicit LegacySender(MQTTWebSocket& mqtt) : mqtt(mqtt) {}
+
+  MQTTPublishStatus sendLive(JsonDocument data) {     // deep copy
+    data["device_id"] = DEVICE_ID;                     // serializeJsonDoc()
+    std::string payload;
+    serializeJson(data, payload);
+    MQTTPublishStatus st = mqtt.tryPublish(TOPIC, (const uint8_t*)payload.data(), payload.size());
+
+    std::string json;                                  // SSE
+    serializeJson(data, json);
+    copied += payload.size() * 2 + json.size();        // 2 renders + frame copy
+    return st;
+  }
+};
+
+// ── Current: Automata::publishLive → publishDoc/streamPublish ──
+struct Sender {
+  MQTTWebSocket& mqtt;
+  bool sseListening;
+  std::vector<char> payloadBuf;
+  size_t copied = 0;
+
+  Sender(MQTTWebSocket& mqtt, bool sseListening) : mqtt(mqtt), sseListening(sseListening) {}
+
+  MQTTPublishStatus sendLive(JsonDocument& doc) {
+    bool addId = doc["device_id"].isNull();
+    if (addId) doc["device_id"] = DEVICE_ID;
+    size_t len = measureJson(doc);
+    MQTTPublishStatus st = mqtt.tryPublishWith(TOPIC, len, [&](uint8_t* dst) {
+      return serializeJson(doc, dst, len);
+    });
+    copied += len;
+    if (sseListening) copied += serializeToBuffer(doc);
+    if (addId) doc.remove("device_id");
+    return st;
+  }
+
+  // serializeToBuffer(): payloadBuf only grows
+  size_t serializeToBuffer(JsonDocument& doc) {
+    size_t len = measureJson(doc);
+    if (len + 1 > payloadBuf.size()) payloadBuf.resize(len + 1);
+    return serializeJson(doc, payloadBuf.data(), payloadBuf.size());
+  }
+};
+
+void setUp() {}
+void tearDown() {}
+
+// ── Correctness ───────────────────────────────
+void test_same_bytes_on_the_wire() {
+  MQTTWebSocket mqtt;
+  WebSocketsClient& ws = connectMqtt(mqtt);
+  JsonDocument doc(&jsonAlloc);
+  fillSample(doc, 3);
+
+  LegacySender legacy{mqtt};
+  TEST_ASSERT_EQUAL(MQTT_PUB_OK, legacy.sendLive(doc));
+  Sender now{mqtt, true};
+  TEST_ASSERT_EQUAL(MQTT_PUB_OK, now.sendLive(doc));
+
+  TEST_ASSERT_EQUAL(2, ws.sent.size());
+  TEST_ASSERT_EQUAL(ws.sent[0].size(), ws.sent[1].size());
+  TEST_ASSERT_EQUAL_MEMORY(ws.sent[0].data(), ws.sent[1].data(), ws.sent[0].size());
+  TEST_ASSERT_TRUE(doc["device_id"].isNull());         // caller's document unchanged
+}
+
+// ── Benchmark ─────────────────────────────────
+static void bench(bool sseListening) {
+  const int N = 20000;
+  MQTTWebSocket mqtt;
+  WebSocketsClient& ws = connectMqtt(mqtt);
+  ws.keepFrames = false;
+
+  JsonDocument doc(&jsonAlloc);
+  fillSample(doc, 0);
+
+  Sender now{mqtt, sseListening};
+  now.sendLive(doc);                                   // warm up payloadBuf
+  now.copied = 0;
+  AllocStats a = countAllocs([&] {
+    for (int i = 0; i < N; i++) {
+      fillSample(doc, i);
+      now.sendLive(doc);
+    }
+  });
+
+  LegacySender legacy{mqtt};
+  AllocStats b = countAllocs([&] {
+    for (int i = 0; i < N; i++) {
+      fillSample(doc, i);
+      legacy.sendLive(doc);
+    }
+  });
+
+  printf("SSE %-3s | allocs/sendLive %.2f → %.2f | heap bytes %6.1f → %6.1f | bytes copied %4u → %4u\n",
+         sseListening ? "on" : "off",
+         (double)b.allocs / N, (double)a.allocs / N,
+         (double)b.bytes / N, (double)a.bytes / N,
+         (unsigned)(legacy.copied / N), (unsigned)(now.copied / N));
+
+  TEST_ASSERT_LESS_THAN(b.allocs, a.allocs);
+  TEST_ASSERT_LESS_THAN(legacy.copied, now.copied);
+}
+
+void test_bench_send_live() {
+  bench(false);
+  bench(true);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_same_bytes_on_the_wire);
+  RUN_TEST(test_bench_send_live);
+  return UNITY_END();
+}
@@ -0,0 +1,144 @@
+// ─────────────────────────────────────────────
+//  TopicTrie: + / # matching against a reference linear matcher, and a
+//  dispatch benchmark over thousands of filters (trie vs. scanning every
+//  filter, which is what per-message string comparisons amount to).
+//
+//    pio test -e native -f test_topic_trie -v
+// ─────────────────────────────────────────────
+#include <unity.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "AllocCounter.h"
+#include "Arduino.h"
+#include "TopicTrie.h"
+
+// Reference: MQTT filter matching, one filter at a time
+static bool matches(const std::string& filter, const std::string& topic) {
+  if (!topic.empty() && topic[0] == '$' && (filter[0] == '+' || filter[0] == '#')) return false;
+  size_t f = 0, t = 0;
+  for (;;) {
+    size_t fe = filter.find('/', f), te = topic.find('/', t);
+    std::string fl = filter.substr(f, fe == std::string::npos ? std::string::npos : fe - f);
+    if (fl == "#") return true;
+    if (t == std::string::npos) return false;
+    std::string tl = topic.substr(t, te == std::string::npos ? std::string::npos : te - t);
+    if (fl != "+" && fl != tl) return false;
+    if (fe == std::string::npos || te == std::string::npos) {
+      if (fe == std::string::npos && te == std::string::npos) return true;
+      // "a/#" also matches "a"
+      return te == std::string::npos && filter.compare(fe + 1, std::string::npos, "#") == 0;
+    }
+    f = fe + 1;
+    t = te + 1;
+  }
+}
+
+static std::vector<int> trieHits(TopicTrie<int>& trie, const std::string& topic) {
+  std::vector<int> hits;
+  trie.match(topic.c_str(), topic.size(), [&](const int& v) { hits.push_back(v); });
+  std::sort(hits.begin(), hits.end());
+  return hits;
+}
+
+static std::vector<std::string> makeFilters(size_t n) {
+  std::vector<std::string> filters;
+  for (size_t i = 0; i < n; i++) {
+    std::string id = std::to_string(i);
+    switch (i % 5) {
+      case 0: filters.push_back("site/" + id + "/cmd/#"); break;
+      case 1: filters.push_back("site/" + id + "/+/status"); break;
+      case 2: filters.push_back("dev/" + id + "/action"); break;
+      case 3: filters.push_back("dev/" + id + "/update"); break;
+      case 4: filters.push_back("+/" + id + "/+"); break;
+    }
+  }
+  filters.push_back("#");
+  filters.push_back("site/+/cmd/reboot");
+  return filters;
+}
+
+static std::string randomTopic(size_t n) {
+  static const char* heads[] = {"site", "dev", "other", "$SYS"};
+  static const char* tails[] = {"cmd/reboot", "cmd", "x/status", "action", "update", "a/b/c"};
+  return std::string(heads[rand() % 4]) + "/" + std::to_string(rand() % (n + 10)) + "/" +
+         tails[rand() % 6];
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_wildcards() {
+  TopicTrie<int> trie;
+  trie.insert("a/+/c", 1);
+  trie.insert("a/#", 2);
+  trie.insert("#", 3);
+  trie.insert("a/b/c", 4);
+  TEST_ASSERT_TRUE((trieHits(trie, "a/b/c") == std::vector<int>{1, 2, 3, 4}));
+  TEST_ASSERT_TRUE((trieHits(trie, "a") == std::vector<int>{2, 3}));
+  TEST_ASSERT_TRUE((trieHits(trie, "$SYS/x") == std::vector<int>{}));
+  TEST_ASSERT_FALSE(trie.insert("a/#/c", 5));
+  TEST_ASSERT_FALSE(trie.insert("a+/b", 5));
+  TEST_ASSERT_TRUE(trie.remove("a/#"));
+  TEST_ASSERT_TRUE((trieHits(trie, "a") == std::vector<int>{3}));
+}
+
+void test_matches_reference() {
+  std::vector<std::string> filters = makeFilters(500);
+  TopicTrie<int> trie;
+  for (size_t i = 0; i < filters.size(); i++) trie.insert(filters[i].c_str(), (int)i);
+
+  srand(3);
+  for (int k = 0; k < 3000; k++) {
+    std::string topic = randomTopic(500);
+    std::vector<int> expect;
+    for (size_t i = 0; i < filters.size(); i++)
+      if (matches(filters[i], topic)) expect.push_back((int)i);
+    TEST_ASSERT_TRUE_MESSAGE(trieHits(trie, topic) == expect, topic.c_str());
+  }
+}
+
+void test_bench_dispatch() {
+  const size_t FILTERS = 5000;
+  const int    N       = 20000;
+  std::vector<std::string> filters = makeFilters(FILTERS);
+  TopicTrie<int> trie;
+  for (size_t i = 0; i < filters.size(); i++) trie.insert(filters[i].c_str(), (int)i);
+
+  srand(4);
+  std::vector<std::string> topics;
+  for (int i = 0; i < 256; i++) topics.push_back(randomTopic(FILTERS));
+
+  size_t hitsTrie = 0, hitsScan = 0;
+  auto t0 = std::chrono::steady_clock::now();
+  AllocStats a = countAllocs([&] {
+    for (int i = 0; i < N; i++) {
+      const std::string& t = topics[i % topics.size()];
+      hitsTrie += trie.match(t.c_str(), t.size(), [](const int&) {});
+    }
+  });
+  auto t1 = std::chrono::steady_clock::now();
+  const int SCANS = N / 20;   // the scan is slow; fewer rounds, same per-dispatch figure
+  for (int i = 0; i < SCANS; i++) {
+    const std::string& t = topics[i % topics.size()];
+    for (auto& f : filters) hitsScan += matches(f, t);
+  }
+  auto t2 = std::chrono::steady_clock::now();
+
+  double nsTrie = std::chrono::duration<double, std::nano>(t1 - t0).count() / N;
+  double nsScan = std::chrono::duration<double, std::nano>(t2 - t1).count() / SCANS;
+  printf("dispatch over %u filters | ns/dispatch scan %.0f → trie %.0f | allocs/dispatch %.2f\n",
+         (unsigned)filters.size(), nsScan, nsTrie, (double)a.allocs / N);
+
+  TEST_ASSERT_EQUAL(0, a.allocs);
+  TEST_ASSERT_GREATER_THAN(0, (long)hitsTrie);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_wildcards);
+  RUN_TEST(test_matches_reference);
+  RUN_TEST(test_bench_dispatch);
+  return UNITY_END();
+}